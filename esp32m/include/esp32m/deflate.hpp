@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace esp32m {
+  namespace deflate {
+
+    /**
+     * Appends DEFLATE (RFC 1951) compressed @c data to @c out. Uses fixed
+     * Huffman codes and greedy LZ77 matching with a single hash probe, which
+     * trades some compression ratio for speed and a small (4KB) temporary
+     * hash table. Works well for repetitive text like JSON and line protocol.
+     * @param final if @c false, the block is not marked final and the stream
+     * ends with a sync flush (empty stored block) instead
+     * @param windowBits limits match distances to 2^windowBits (8..15)
+     */
+    void compress(const void *data, size_t len, std::string &out,
+                  bool final = true, int windowBits = 15);
+
+    /**
+     * Appends decompressed raw DEFLATE stream to @c out. The stream may end
+     * after the final block or at any block boundary, as with sync flush.
+     * Matches may only refer to data decompressed by this call.
+     * @return @c false if the stream is malformed or decompresses to more
+     * than @c limit bytes
+     */
+    bool inflate(const void *data, size_t len, std::string &out,
+                 size_t limit);
+
+    /**
+     * Appends gzip (RFC 1952) member with compressed @c data to @c out
+     */
+    void gzip(const void *data, size_t len, std::string &out);
+
+    /**
+     * Updates zlib-compatible CRC-32, start with @c crc = 0
+     */
+    uint32_t crc32(uint32_t crc, const void *data, size_t len);
+
+  }  // namespace deflate
+}  // namespace esp32m
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "esp32m/device.hpp"
+#include "esp32m/sensor/expr.hpp"
+
+namespace esp32m {
+  namespace dev {
+
+    /**
+     * Sensors whose values are computed from other sensors. Each sensor is
+     * defined in the config by an expression over sensor uids (see
+     * sensor::Expression), it is compiled once and evaluated again whenever
+     * one of its inputs changes:
+     * @code
+     * {"dew_point": {"expr": "243.04*(ln(bme280_humidity/100)+...)",
+     *                "type": "temperature", "unit": "°C", "precision": 1},
+     *  "delta_t": {"expr": "dsts_28ff01 - dsts_28ff02"}}
+     * @endcode
+     * Sensors cannot be unregistered, so removing one from the config only
+     * disables it. The type of a sensor is fixed when it is first created.
+     */
+    class Virtual : public Device {
+     public:
+      Virtual(const char *name);
+      Virtual(const Virtual &) = delete;
+      const char *name() const override {
+        return _name;
+      }
+
+     protected:
+      void handleEvent(Event &ev) override;
+      DynamicJsonDocument *getState(const JsonVariantConst args) override;
+      bool setConfig(const JsonVariantConst cfg,
+                     DynamicJsonDocument **result) override;
+      DynamicJsonDocument *getConfig(RequestContext &ctx) override;
+
+     private:
+      struct Entry {
+        std::string type, unit, title, source;
+        sensor::Expression expr;
+        // handles of resolved inputs, -1 if the input is not registered yet
+        std::vector<int> inputs;
+        std::unique_ptr<Sensor> sensor;
+        bool enabled = false;
+        // guards against expressions that depend on each other
+        bool evaluating = false;
+      };
+      const char *_name;
+      std::recursive_mutex _mutex;
+      std::map<std::string, std::unique_ptr<Entry> > _entries;
+      // entries that depend on a sensor, indexed by sensor handle
+      std::vector<std::vector<Entry *> > _dependents;
+      // sensor::generation() at the time of the last resolve()
+      uint32_t _resolvedGeneration = 0;
+      int _unresolved = 0;
+      void resolve();
+      void rebuild();
+      void evaluate(Entry *entry);
+      void changed(const Sensor *sensor, std::vector<Entry *> &pending);
+    };
+
+    Virtual *useVirtual(const char *name = "virtual");
+  }  // namespace dev
+}  // namespace esp32m
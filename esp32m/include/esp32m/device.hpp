@@ -3,6 +3,8 @@
 #include <ArduinoJson.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <mutex>
 
@@ -10,6 +12,7 @@
 #include "esp32m/defs.hpp"
 #include "esp32m/events.hpp"
 #include "esp32m/json.hpp"
+#include "esp32m/sensor/filter.hpp"
 
 #include <type_traits>
 
@@ -18,6 +21,10 @@ namespace esp32m {
   class Device;
   class Sensor;
 
+  namespace sensor {
+    class Poller;
+  }
+
   class EventSensor : public Event, public json::PropsContainer {
    public:
     EventSensor(const Device &device, const char *sensor, const float value,
@@ -77,16 +84,35 @@ namespace esp32m {
 
     void setSensorsPollInterval(int intervalMs) {
       _sensorsPollInterval = intervalMs;
+      _sensorsPollCurrent = clampSensorsPollInterval(intervalMs);
+      if (hasSensors())
+        scheduleSensorsPoll();
     };
     int getSensorsPollInterval() const {
       return _sensorsPollInterval;
     }
+    /**
+     * Enables adaptive polling: the poll interval shrinks towards @c minMs
+     * while sensor readings keep changing and grows towards @c maxMs while
+     * they are stable. Adaptive polling is disabled if either bound is not
+     * positive or @c minMs is not less than @c maxMs, the interval set by
+     * setSensorsPollInterval() is used then. @c minMs is raised to 100 ms.
+     */
+    void setSensorsPollBounds(int minMs, int maxMs);
+    /**
+     * @return poll interval currently in effect
+     */
+    int getSensorsPollCurrent() const {
+      return _sensorsPollCurrent;
+    }
+    bool isSensorsPollAdaptive() const {
+      return _sensorsPollMin > 0 && _sensorsPollMin < _sensorsPollMax;
+    }
 
    protected:
     Flags _flags = Flags::None;
     Device(){};
     void init(const Flags flags);
-    void handleEvent(Event &ev) override;
     virtual bool initSensors() {
       return true;
     }
@@ -99,8 +125,15 @@ namespace esp32m {
       return true;
     };
     virtual unsigned long nextSensorsPollTime() {
-      return _sensorsPolledAt + _sensorsPollInterval;
+      return _sensorsPolledAt + _sensorsPollCurrent;
     };
+    /**
+     * Called after each poll when adaptive polling is enabled, adjusts
+     * the current poll interval
+     * @param changed whether any sensor of this device reported a change
+     * during the poll
+     */
+    virtual void adaptSensorsPollInterval(bool changed);
     virtual bool shouldPollSensors() {
       return millis() >= nextSensorsPollTime();
     };
@@ -109,10 +142,29 @@ namespace esp32m {
     bool _sensorsReady = false;
     unsigned long _sensorsInitAt = 0;
     unsigned long _sensorsPolledAt = 0;
+    // deadline this device is currently queued for in sensor::Poller
+    unsigned long _sensorsPollAt = 0;
     unsigned int _reinitDelay = 10000;
     int _sensorsPollInterval = 1000;
+    // set from the config task, read by the poller
+    std::atomic<int> _sensorsPollCurrent = 1000;
+    std::atomic<int> _sensorsPollMin = 0, _sensorsPollMax = 0;
+    bool _sensorsChanged = false;
+    // last values reported through the legacy sensor() calls, kept only
+    // while adaptive polling needs them to tell changes
+    std::map<std::string, float, std::less<>> _legacyValues;
     bool sensorsReady();
-    static void setupSensorPollTask();
+    void legacySensor(const char *sensor, float value);
+    int clampSensorsPollInterval(int interval) const {
+      int lo = _sensorsPollMin, hi = _sensorsPollMax;
+      if (lo <= 0 || lo >= hi)
+        return interval;
+      return std::clamp(interval, lo, hi);
+    }
+    void runSensorsPoll();
+    void scheduleSensorsPoll();
+    friend class sensor::Poller;
+    friend class Sensor;
   };
 
   ENUM_FLAG_OPERATORS(Device::Flags)
@@ -121,9 +173,41 @@ namespace esp32m {
 
     enum class StateClass { Undefined, Measurement, Total, TotalIncreasing };
 
-    Sensor *find(std::string uid);
+    Sensor *find(const char *uid);
+    Sensor *find(const std::string &uid);
     Sensor *find(Device *device, const char *id);
+    /**
+     * @return sensor with the given handle, or @c nullptr if there is none
+     */
+    Sensor *byHandle(int handle);
+    /**
+     * @return number of registered sensors, handles are in [0, count())
+     */
+    int count();
+    /**
+     * @return counter that changes whenever a sensor is registered or its
+     * uid changes, so lookups by uid may give a different result
+     */
+    uint32_t generation();
     int nextGroup();
+    /**
+     * Rebuilds uids of the sensors of the device, to be called when the
+     * device name has changed, e.g. after the chip was detected
+     */
+    void reindex(Device *device);
+    /**
+     * @return counter that changes whenever any sensor value changes
+     */
+    uint32_t version();
+    /**
+     * Advances version(), called by Sensor::set()
+     */
+    void touch();
+    /**
+     * Held while a sensor value is replaced and while values are copied by
+     * other tasks, so they never see a string that is being freed
+     */
+    std::mutex &valuesMutex();
 
     class Changed : public Event {
      public:
@@ -150,38 +234,39 @@ namespace esp32m {
       constexpr static const char *Type = "sensor-changed";
     };
 
+    /**
+     * Iterates over registered sensors by index, so sensors registered by
+     * other tasks in the meantime do not invalidate the iterator. Sensors are
+     * never unregistered.
+     */
+    class Iterator {
+     public:
+      Iterator(int group, size_t index) : _group(group), _index(index) {}
+      bool operator==(const Iterator &other) const {
+        return _index == other._index;
+      }
+      bool operator!=(const Iterator &other) const {
+        return _index != other._index;
+      }
+      Sensor *operator*() const;
+      Iterator &operator++() {
+        _index++;
+        return *this;
+      }
+
+     private:
+      int _group;  // 0 means all sensors
+      size_t _index;
+    };
+
     class Group {
      public:
+      typedef sensor::Iterator Iterator;
       Group(int id) : _id(id) {}
-      struct Iterator {
-       public:
-        typedef std::map<std::string, Sensor *>::iterator Inner;
-        Iterator(int id);
-        bool operator==(const Iterator &other) const {
-          return _inner == other._inner;
-        }
-        bool operator!=(const Iterator &other) const {
-          return _inner != other._inner;
-        }
-        Sensor *operator*() const {
-          return _inner->second;
-        }
-        Iterator &operator++() {
-          next();
-          return *this;
-        }
-
-       private:
-        int _id;
-        Inner _inner;
-        void next();
-      };
       Iterator begin() const {
-        return Iterator(_id);
-      }
-      Iterator end() const {
-        return Iterator(-1);
+        return Iterator(_id, 0);
       }
+      Iterator end() const;
 
      private:
       int _id;
@@ -189,29 +274,10 @@ namespace esp32m {
 
     class All {
      public:
-      struct Iterator {
-       public:
-        typedef std::map<std::string, Sensor *>::iterator Inner;
-        Iterator(Inner inner) : _inner(inner) {}
-        bool operator==(const Iterator &other) const {
-          return _inner == other._inner;
-        }
-        bool operator!=(const Iterator &other) const {
-          return _inner != other._inner;
-        }
-        Sensor *operator*() const {
-          return _inner->second;
-        }
-        Iterator &operator++() {
-          _inner++;
-          return *this;
-        }
-
-       private:
-        Inner _inner;
-        void next();
-      };
-      Iterator begin() const;
+      typedef sensor::Iterator Iterator;
+      Iterator begin() const {
+        return Iterator(0, 0);
+      }
       Iterator end() const;
     };
 
@@ -243,8 +309,50 @@ namespace esp32m {
     enum EmitFlags { None = 0, Periodically = 1 << 0, OnChange = 1 << 1 };
 
     ENUM_FLAG_OPERATORS(EmitFlags)
-    struct QueueItem {
-      const Sensor *sensor;
+
+    /**
+     * Set of sensor handles that is safe to update from any task without
+     * locking. Storage grows in blocks that are allocated on first use and
+     * kept for the lifetime of the set.
+     */
+    class DirtySet {
+     public:
+      DirtySet() {}
+      DirtySet(const DirtySet &) = delete;
+      ~DirtySet() {
+        for (auto &block : _blocks) delete[] block.load();
+      }
+      /**
+       * @return @c true if the handle was not in the set before
+       */
+      bool set(int handle);
+      /**
+       * Removes all handles from the set, calling @c f for each of them
+       */
+      template <typename F>
+      void drain(F f) {
+        for (int b = 0; b < MaxBlocks; b++) {
+          auto words = _blocks[b].load(std::memory_order_acquire);
+          if (!words)
+            continue;
+          for (int w = 0; w < BlockWords; w++) {
+            uint32_t bits = words[w].exchange(0);
+            while (bits) {
+              f(b * BlockWords * 32 + w * 32 + __builtin_ctz(bits));
+              bits &= bits - 1;
+            }
+          }
+        }
+      }
+      void clear() {
+        drain([](int) {});
+      }
+
+     private:
+      static constexpr int BlockWords = 8;
+      // 8192 handles in total
+      static constexpr int MaxBlocks = 32;
+      std::atomic<std::atomic<uint32_t> *> _blocks[MaxBlocks] = {};
     };
 
     class StateEmitter : public AppObject {
@@ -269,7 +377,7 @@ namespace esp32m {
 
      protected:
       void handleEvent(Event &ev) override;
-      virtual void emit(std::vector<const Sensor *> sensors) = 0;
+      virtual void emit(const std::vector<const Sensor *> &sensors) = 0;
       virtual bool filter(const Sensor *sensor) {
         return true;
       }
@@ -279,23 +387,197 @@ namespace esp32m {
       int _interval = 1000;
       unsigned long _emittedAt = 0;
       TaskHandle_t _task = nullptr;
-      std::mutex _queueMutex;
-      std::map<std::string, QueueItem> _queue;
+      DirtySet _dirty;
       void run();
     };
 
+    /**
+     * Compact tagged storage for a single sensor reading. Numbers, booleans
+     * and short strings are kept inline, longer strings are allocated on the
+     * heap. The value is converted to JSON only when it is serialized.
+     */
+    class Value {
+     public:
+      enum class Type : uint8_t { Null, Float, Int, Bool, String };
+      Value() {}
+      Value(const Value &other) {
+        assign(other);
+      }
+      ~Value() {
+        release();
+      }
+      Value &operator=(const Value &other) {
+        if (this != &other) {
+          release();
+          assign(other);
+        }
+        return *this;
+      }
+      Type type() const {
+        return _type;
+      }
+      bool isNull() const {
+        return _type == Type::Null;
+      }
+      template <typename T>
+      bool is() const {
+        if constexpr (std::is_same_v<T, bool>)
+          return _type == Type::Bool;
+        else if constexpr (std::is_floating_point_v<T>)
+          return _type == Type::Float || _type == Type::Int;
+        else if constexpr (std::is_integral_v<T>)
+          return _type == Type::Int;
+        else
+          return _type == Type::String;
+      }
+      template <typename T>
+      T as() const {
+        if constexpr (std::is_arithmetic_v<T>) {
+          switch (_type) {
+            case Type::Float:
+              return (T)_u.f;
+            case Type::Int:
+              return (T)_u.i;
+            case Type::Bool:
+              return (T)_u.b;
+            default:
+              return (T)0;
+          }
+        } else
+          return _type == Type::String ? str() : nullptr;
+      }
+      template <typename T>
+      bool equals(T value) const {
+        if constexpr (std::is_same_v<T, bool>)
+          return _type == Type::Bool && _u.b == value;
+        // compared as stored: set() narrows floating point values to float
+        // and integers to int32_t
+        else if constexpr (std::is_floating_point_v<T>)
+          return _type == Type::Float ? _u.f == (float)value
+                                      : _type == Type::Int && _u.i == value;
+        else if constexpr (std::is_integral_v<T>)
+          return _type == Type::Int ? _u.i == (int32_t)value
+                                    : _type == Type::Float && _u.f == value;
+        else if constexpr (std::is_same_v<T, std::string>)
+          return equals(value.c_str());
+        else
+          return _type == Type::String && value && !strcmp(str(), value);
+      }
+      template <typename T>
+      void set(T value) {
+        release();
+        if constexpr (std::is_same_v<T, bool>) {
+          _type = Type::Bool;
+          _u.b = value;
+        } else if constexpr (std::is_floating_point_v<T>) {
+          _type = Type::Float;
+          _u.f = value;
+        } else if constexpr (std::is_integral_v<T>) {
+          _type = Type::Int;
+          _u.i = value;
+        } else if constexpr (std::is_same_v<T, std::string>)
+          setString(value.c_str());
+        else
+          setString(value);
+      }
+      /**
+       * @return number of bytes this value needs in a JSON document
+       */
+      size_t memoryUsage() const {
+        return _type == Type::String ? JSON_STRING_SIZE(strlen(str())) : 0;
+      }
+
+     private:
+      static constexpr size_t InlineChars = 8;
+      Type _type = Type::Null;
+      bool _heap = false;
+      union {
+        float f;
+        int32_t i;
+        bool b;
+        char s[InlineChars];
+        char *p;
+      } _u = {};
+      const char *str() const {
+        return _heap ? _u.p : _u.s;
+      }
+      void setString(const char *value);
+      void assign(const Value &other);
+      void release();
+    };
+
+    bool convertToJson(const Value &src, JsonVariant dst);
+
+    /**
+     * Limits how often a sensor reports changes. All limits are disabled by
+     * default, so every change is reported.
+     */
+    struct Limits {
+      // changes smaller than this are not reported
+      float deadband = 0;
+      // same as deadband, but relative to the last reported value
+      float deadbandRel = 0;
+      // changes are not reported more often than this, in milliseconds
+      unsigned int minInterval = 0;
+      // value is reported at least this often even if it did not change
+      unsigned int heartbeat = 0;
+      bool enabled() const {
+        return deadband > 0 || deadbandRel > 0 || minInterval || heartbeat;
+      }
+    };
+
+    /**
+     * Answers @c sensors-snapshot requests, see snapshot().
+     * Keeps per-sensor settings in the configuration, keyed by sensor uid,
+     * and applies them to sensors as they are registered:
+     * @code
+     * {"ina226_power": {"deadband": 0.5, "min_interval": 1000,
+     *                   "filters": [{"type": "median", "size": 5},
+     *                               {"type": "ema", "alpha": 0.3}]}}
+     * @endcode
+     */
+    class Manager : public AppObject {
+     public:
+      Manager(const Manager &) = delete;
+      static Manager &instance();
+      const char *name() const override {
+        return "sensors";
+      }
+      void configure(Sensor *sensor);
+      /**
+       * Captures values of all enabled sensors in one document:
+       * @code
+       * {"version": 42, "millis": 123456,
+       *  "sensors": {"<uid>": [<value>, <millis when set>], ...}}
+       * @endcode
+       * @param args optional filters: @c group, @c type and @c device, and
+       * @c version from a previous snapshot. If nothing changed since that
+       * version, the snapshot has no @c sensors member.
+       */
+      DynamicJsonDocument *snapshot(const JsonVariantConst args);
+
+     protected:
+      bool handleRequest(Request &req) override;
+      bool setConfig(const JsonVariantConst cfg,
+                     DynamicJsonDocument **result) override;
+      DynamicJsonDocument *getConfig(RequestContext &ctx) override;
+
+     private:
+      std::mutex _mutex;
+      std::unique_ptr<DynamicJsonDocument> _config;
+      Manager() {}
+    };
+
   }  // namespace sensor
 
   class Sensor {
    public:
     int precision = -1;
-    int group = 0;
     bool disabled = false;
     sensor::StateClass stateClass = sensor::StateClass::Undefined;
     const char *unit = nullptr;
     const char *name = nullptr;
-    Sensor(Device *device, const char *type, const char *id = nullptr,
-           size_t size = 0);
+    Sensor(Device *device, const char *type, const char *id = nullptr);
     Sensor(const Sensor &) = delete;
     const char *type() const {
       return _type;
@@ -304,38 +586,62 @@ namespace esp32m {
      * @return sensor identifier that is unique in its device scope
      */
     const char *id() const {
-      if (!_id.empty())
-        return _id.c_str();
-      return _type;
+      return _id.c_str();
     }
     /**
-     * @return sensor identifier that is unique in the project scope
+     * @return sensor identifier that is unique in the project scope. Built
+     * on first use, and again if the device name has changed since, as
+     * drivers may learn the name only when they detect the chip
+     */
+    const std::string &uid() const;
+    /**
+     * @return dense index of this sensor, assigned at registration
      */
-    std::string uid() const {
-      std::string uid(_device->name());
-      uid += "_";
-      uid += id();
-      return uid;
+    int handle() const {
+      return _handle;
     }
+    int group() const {
+      return _group;
+    }
+    void setGroup(int group);
     Device *device() const {
       return _device;
     }
     bool is(const char *t) const {
       return t && !strcmp(type(), t);
     }
+    /**
+     * Passes numeric values through the filter pipeline, updates the value and
+     * reports the change, unless it is filtered out by the sensor limits.
+     * Grouped sensors only set @c changed, the driver is expected to report
+     * the group.
+     */
     template <typename T>
     void set(T value, bool *changed = nullptr) {
+      if constexpr (std::is_floating_point_v<T>) {
+        float filtered = value;
+        if (!filter(filtered))
+          return;
+        value = filtered;
+      }
       if constexpr (std::is_same_v<T, float>)
         if (precision >= 0)
           value = roundTo(value, precision);
-      auto c = _value != value;
-      _value.set(value);
-      if (c) {
-        if (changed)
-          *changed = true;
-        if (group <= 0)
-          sensor::Changed::publish(this);
+      _updatedAt = millis();
+      bool same = _value.equals(value);
+      if (!same) {
+        std::lock_guard lock(sensor::valuesMutex());
+        _value.set(value);
+        sensor::touch();
       }
+      if (!shouldReport(!same))
+        return;
+      if (!same)
+        _device->_sensorsChanged = true;
+      if (changed)
+        *changed = true;
+      if (_group <= 0)
+        sensor::Changed::publish(this);
     }
     void to(JsonObject target) const {
       if (precision >= 0 && _value.is<float>())
@@ -343,9 +649,39 @@ namespace esp32m {
       else
         target[id()] = _value;
     }
-    JsonVariantConst get() const {
+    const sensor::Value &get() const {
       return _value;
     }
+    /**
+     * @return millis() of the last reading that passed the filters
+     */
+    unsigned long updatedAt() const {
+      return _updatedAt;
+    }
+    /**
+     * @return limits currently in effect, only safe to read from the task
+     * that calls set()
+     */
+    const sensor::Limits &limits() const {
+      return _limits;
+    }
+    /**
+     * May be called from any task, the limits are swapped in by the next
+     * set()
+     */
+    void setLimits(const sensor::Limits &limits);
+    /**
+     * Replaces the filter pipeline, takes ownership of it. May be called from
+     * any task, the pipeline is swapped in by the next set().
+     */
+    void setFilters(sensor::Pipeline *pipeline);
+    /**
+     * @return whether a filter pipeline is configured, drivers may skip
+     * their own averaging then
+     */
+    bool filtered() const {
+      return _filtered;
+    }
     JsonObjectConst props() const {
       return _props ? _props->as<JsonObjectConst>()
                     : json::null<JsonObjectConst>();
@@ -355,8 +691,32 @@ namespace esp32m {
     Device *_device;
     const char *_type;
     std::string _id;
-    DynamicJsonDocument _value;
+    // "<device name>_<id>", guarded by the registry lock
+    mutable std::string _uid;
+    // whether the sensor is in the registry ordered by uid
+    mutable bool _indexed = false;
+    int _handle;
+    int _group = 0;
+    sensor::Value _value;
+    unsigned long _updatedAt = 0;
+    sensor::Limits _limits;
+    std::atomic<sensor::Limits *> _nextLimits = nullptr;
+    // last reported value, deadband is measured from it
+    float _reported = 0;
+    unsigned long _reportedAt = 0;
+    bool _everReported = false;
+    // value changed since it was last reported
+    bool _pending = false;
     std::unique_ptr<DynamicJsonDocument> _props;
+    std::unique_ptr<sensor::Pipeline> _pipeline;
+    std::atomic<sensor::Pipeline *> _nextPipeline = nullptr;
+    std::atomic<bool> _filtered = false;
+    bool filter(float &value);
+    bool shouldReport(bool changed);
+    void reindex() const;
+    friend Sensor *sensor::find(const char *uid);
+    friend Sensor *sensor::find(Device *device, const char *id);
+    friend void sensor::reindex(Device *device);
   };
 
 }  // namespace esp32m
\ No newline at end of file
@@ -53,7 +53,7 @@ namespace esp32m {
           auto id = req.data()["id"].as<const char *>();
           if (!id || sensor.uid() != id)
             return;
-          auto value = sensor.get();
+          auto &value = sensor.get();
           DynamicJsonDocument *doc = new DynamicJsonDocument(
               JSON_OBJECT_SIZE(2) + value.memoryUsage());
           auto root = doc->to<JsonObject>();
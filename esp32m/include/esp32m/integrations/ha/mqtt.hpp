@@ -1,11 +1,17 @@
 #pragma once
 
 #include "esp32m/app.hpp"
+#include "esp32m/config/config.hpp"
 #include "esp32m/integrations/ha/config.hpp"
 #include "esp32m/integrations/ha/ha.hpp"
 #include "esp32m/net/mqtt.hpp"
+#include "esp32m/props.hpp"
 
 #include <esp_task_wdt.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
 
 namespace esp32m {
   namespace integrations {
@@ -29,8 +35,8 @@ namespace esp32m {
               auto &mqtt = net::Mqtt::instance();
               _sub = mqtt.subscribe(
                   commandTopic.c_str(),
-                  [this](std::string topic, std::string payload) {
-                    command(payload);
+                  [this](std::string_view topic, std::string_view payload) {
+                    command(std::string(payload));
                   });
             }
           }
@@ -84,28 +90,82 @@ namespace esp32m {
           if (EventInited::is(ev)) {
             xTaskCreate([](void *self) { ((Mqtt *)self)->run(); }, "m/ha-mqtt",
                         4096, this, tskIDLE_PRIORITY, &_task);
+          } else if (EventPropChanged::is(ev, nullptr) ||
+                     config::Changed::is(ev)) {
+            // only entries that actually changed will be republished, but
+            // the config may change what sensors are described as
+            _describeRequested = 0;
+            _keysStale = true;
           }
         }
 
        private:
+        // number of discovery entries published in one go, and the pause
+        // between such bursts
+        static const int PublishBurst = 4;
+        static const int PublishPause = 100;
         TaskHandle_t _task = nullptr;
         unsigned long _describeRequested = 0, _stateRequested = 0;
         std::map<std::string, std::unique_ptr<mqtt::Dev> > _devices;
+        // hash of the config topic and payload the broker got, by entry id
+        std::map<std::string, uint32_t> _published;
+        // hash of the config queued for publishing and not yet sent, by
+        // entry id
+        std::map<std::string, uint32_t> _queued;
+        // hash of what describeSensor() depends on, by sensor handle, lets
+        // us skip unchanged sensors without building their descriptors
+        std::map<int, uint32_t> _sensorKeys;
+        // sensors that are yet to be described
+        std::deque<int> _pending;
+        struct Sent {
+          std::string id;
+          uint32_t hash;
+          bool sent;
+        };
+        // reported by the MQTT task, applied by ours
+        std::mutex _sentMutex;
+        std::vector<Sent> _sent;
+        net::mqtt::Subscription *_statusSub = nullptr;
+        std::atomic<bool> _haOnline = false, _keysStale = false;
         Mqtt(){};
         void run() {
           esp_task_wdt_add(NULL);
           auto &mqtt = net::Mqtt::instance();
+          _statusSub = mqtt.subscribe(
+              "homeassistant/status",
+              [this](std::string_view topic, std::string_view payload) {
+                // HA has restarted and may have lost discovered entities
+                if (payload == "online") {
+                  _haOnline = true;
+                  wakeUp();
+                }
+              });
           for (;;) {
             esp_task_wdt_reset();
-            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)))
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(_pending.empty()
+                                                          ? 1000
+                                                          : PublishPause)))
               requestState(true);
             if (!mqtt.isReady())
               continue;
 
+            applySent();
+            if (_haOnline.exchange(false)) {
+              _published.clear();
+              _describeRequested = 0;
+            }
+            if (_keysStale.exchange(false))
+              _sensorKeys.clear();
             auto curtime = millis();
             if (_describeRequested == 0 ||
                 (curtime - _describeRequested > 24 * 60 * 60 * 1000))
               describe();
+            for (int i = 0; i < PublishBurst && !_pending.empty(); i++) {
+              auto sensor = sensor::byHandle(_pending.front());
+              _pending.pop_front();
+              if (sensor && !sensor->disabled)
+                describe(sensor);
+            }
             /*if (_stateRequested == 0 || (curtime - _stateRequested > 60 *
               1000)) requestState(false);*/
           }
@@ -119,29 +179,101 @@ namespace esp32m {
             const char *id = data["id"] | key.c_str();
             publishConfig(id, data);
           }
+          // sensors are described lazily, a few at a time, so that we don't
+          // hold all the descriptors at once or flood the broker
+          _pending.clear();
           sensor::All sensors;
           for (auto sensor : sensors)
-            if (!sensor->disabled) {
-              auto id = sensor->uid();
-              auto it = req.responses.find(id);
-              if (it == req.responses.end()) {
-                auto doc = describeSensor(sensor);
-                json::check(this, doc, "describeSensor");
-                auto data = doc->as<JsonVariantConst>();
-                publishConfig(id.c_str(), data);
-                delete doc;
-              }
-            }
+            if (sensor && !sensor->disabled &&
+                req.responses.find(sensor->uid()) == req.responses.end())
+              _pending.push_back(sensor->handle());
+        }
+        void describe(Sensor *sensor) {
+          auto &uid = sensor->uid();
+          auto key = sensorKey(sensor);
+          auto it = _sensorKeys.find(sensor->handle());
+          if (it != _sensorKeys.end() && it->second == key &&
+              _published.find(uid) != _published.end())
+            return;
+          auto doc = describeSensor(sensor);
+          json::check(this, doc, "describeSensor");
+          auto data = doc->as<JsonVariantConst>();
+          publishConfig(uid.c_str(), data);
+          delete doc;
+          _sensorKeys[sensor->handle()] = key;
+        }
+
+        static uint32_t hash(const char *s, uint32_t h = 2166136261u) {
+          if (s)
+            for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;  // FNV-1a
+          return (h ^ 0xff) * 16777619u;  // terminator, "ab"+"c" != "a"+"bc"
+        }
+        static uint32_t hash(const std::string &s, uint32_t h = 2166136261u) {
+          return hash(s.c_str(), h);
+        }
+        static uint32_t hash(int i, uint32_t h) {
+          for (int b = 0; b < 4; b++, i >>= 8)
+            h = (h ^ (i & 0xff)) * 16777619u;
+          return h;
+        }
+        /**
+         * Combines everything describeSensor() reads, without allocating
+         */
+        static uint32_t sensorKey(Sensor *sensor) {
+          auto h = hash(sensor->uid());
+          h = hash(sensor->device()->name(), h);
+          h = hash(sensor->name, h);
+          h = hash(sensor->unit, h);
+          h = hash(sensor->type(), h);
+          h = hash(sensor->precision, h);
+          h = hash((int)sensor->stateClass, h);
+          return hash(sensor->group(), h);
+        }
+
+        void applySent() {
+          std::vector<Sent> sent;
+          {
+            std::lock_guard guard(_sentMutex);
+            sent.swap(_sent);
+          }
+          for (auto &s : sent) {
+            auto it = _queued.find(s.id);
+            if (it == _queued.end() || it->second != s.hash)
+              continue;  // superseded by a newer config
+            _queued.erase(it);
+            if (s.sent)
+              _published[s.id] = s.hash;
+            else
+              // dropped before it reached the broker, the next pass
+              // republishes whatever is missing
+              _describeRequested = 0;
+          }
         }
 
         void publishConfig(const char *id, JsonVariantConst data) {
           ConfigBuilder builder(id, data);
           if (builder.build()) {
-            auto &mqtt = net::Mqtt::instance();
-            /*logD("config topic: %s, payload: %s, acceptsCommands=%d",
-                 configTopic.c_str(), configPayload, acceptsCommands);*/
-            mqtt.publish(builder.configTopic.c_str(),
-                         builder.configPayload.c_str(), 1, true);
+            auto h = hash(builder.configPayload, hash(builder.configTopic));
+            auto published = _published.find(id);
+            auto queued = _queued.find(id);
+            if ((published == _published.end() || published->second != h) &&
+                (queued == _queued.end() || queued->second != h)) {
+              auto &mqtt = net::Mqtt::instance();
+              /*logD("config topic: %s, payload: %s, acceptsCommands=%d",
+                   configTopic.c_str(), configPayload, acceptsCommands);*/
+              std::string key(id);
+              if (mqtt.publish(builder.configTopic.c_str(),
+                               builder.configPayload.c_str(), 1, true,
+                               net::mqtt::Lane::Normal,
+                               [this, key, h](bool sent) {
+                                 {
+                                   std::lock_guard guard(_sentMutex);
+                                   _sent.push_back({key, h, sent});
+                                 }
+                                 wakeUp();
+                               }))
+                _queued[key] = h;
+            }
 
             auto it = _devices.find(id);
             if (it == _devices.end()) {
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <esp_http_client.h>
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "esp32m/device.hpp"
+#include "esp32m/integrations/influx/lines.hpp"
+
+namespace esp32m {
+  namespace integrations {
+    namespace influx {
+
+      /**
+       * Writes sensor readings directly to the InfluxDB v2 HTTP API
+       * (/api/v2/write), no MQTT broker or Telegraf is involved. Lines are
+       * split into batches, optionally gzipped, and kept in a bounded queue
+       * until the server accepts them. One batch is posted per emitter
+       * round, outside the lock, so a slow server doesn't hold up the config
+       * and the state. Failed writes are retried on the following rounds
+       * with exponential backoff; when the queue overflows, the oldest
+       * batches are dropped.
+       * scripts/influx-stub.py stands in for the server during tests and can
+       * inject failures to exercise the retries.
+       */
+      class Http : public sensor::StateEmitter {
+       public:
+        const char *name() const override {
+          return "influx-http";
+        };
+
+        static Http &instance() {
+          static Http i;
+          return i;
+        }
+
+       protected:
+        void handleEvent(Event &ev) override;
+        void emit(const std::vector<const Sensor *> &sensors) override;
+        DynamicJsonDocument *getState(const JsonVariantConst args) override;
+        bool setConfig(const JsonVariantConst cfg,
+                       DynamicJsonDocument **result) override;
+        DynamicJsonDocument *getConfig(RequestContext &ctx) override;
+
+       private:
+        Http(){};
+        std::mutex _mutex;
+        // base URL of the server, e.g. http://influx.local:8086
+        std::string _url, _org, _bucket, _token;
+        // maximum size of uncompressed batch, lines are never split
+        int _batchSize = 4096;
+        // maximum total size of queued batches
+        int _queueSize = 16384;
+        bool _gzip = true;
+        bool _timestamps = true;
+        LineWriter _lines;
+        std::deque<std::string> _queue;
+        size_t _queued = 0;
+        // made by the emitter task under the lock, used by it outside
+        esp_http_client_handle_t _client = nullptr;
+        // client dropped by reset() while it may still be in use
+        esp_http_client_handle_t _stale = nullptr;
+        std::string _endpoint;
+        // advanced by reset(), tells batches posted before it
+        uint32_t _epoch = 0;
+        unsigned long _retryAt = 0;
+        int _backoff = 0;
+        int _status = 0;
+        uint32_t _sent = 0, _failed = 0, _dropped = 0;
+        void enqueue(size_t size);
+        // schedules the retry of a failed write
+        void failed();
+        // drops the oldest batches while the queue is over its size
+        void trim();
+        bool connect();
+        // @return HTTP status, or -1 if the server was not reached
+        int post(esp_http_client_handle_t client, const std::string &body);
+        void reset();
+      };
+
+      static inline Http *useHttp() {
+        return &Http::instance();
+      }
+
+    }  // namespace influx
+  }    // namespace integrations
+}  // namespace esp32m
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "esp32m/device.hpp"
+
+namespace esp32m {
+  namespace integrations {
+    namespace influx {
+
+      /**
+       * @return current time in microseconds since the epoch, or 0 if the
+       * clock has not been set yet
+       */
+      int64_t epochMicros();
+
+      /**
+       * Renders sensor readings as InfluxDB line protocol into a buffer that
+       * is reused between batches. The part of each line before the field
+       * value (measurement, tag set and field key) is rendered once per
+       * sensor and cached until invalidate() is called.
+       */
+      class LineWriter {
+       public:
+        LineWriter() {}
+        LineWriter(const LineWriter &) = delete;
+        /**
+         * Drops cached tag sets, may be called from any task
+         */
+        void invalidate() {
+          _stale = true;
+        }
+        /**
+         * Appends a line with the sensor value, followed by a newline.
+         * @param now result of epochMicros() for the batch, if not 0 the line
+         * is timestamped with the time the sensor was last read
+         * @return @c false if the sensor value is not numeric
+         */
+        bool append(const Sensor *sensor, int64_t now);
+        const char *data() const {
+          return _buf.c_str();
+        }
+        size_t size() const {
+          return _buf.size();
+        }
+        bool empty() const {
+          return _buf.empty();
+        }
+        /**
+         * Passes the first @c count bytes to @c f as a null-terminated string
+         * and removes them, keeping the capacity. @c count must be at a line
+         * boundary.
+         */
+        template <typename F>
+        void consume(size_t count, F f) {
+          auto c = _buf[count];
+          _buf[count] = 0;
+          f(_buf.c_str());
+          _buf[count] = c;
+          _buf.erase(0, count);
+        }
+        void clear() {
+          _buf.clear();
+        }
+
+       private:
+        std::string _buf;
+        std::vector<std::string> _tags;
+        std::atomic<bool> _stale = false;
+        const std::string &tags(const Sensor *sensor);
+      };
+
+    }  // namespace influx
+  }    // namespace integrations
+}  // namespace esp32m
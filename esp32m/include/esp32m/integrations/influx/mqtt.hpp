@@ -1,4 +1,5 @@
 #include "esp32m/device.hpp"
+#include "esp32m/integrations/influx/lines.hpp"
 
 namespace esp32m {
   namespace integrations {
@@ -16,11 +17,19 @@ namespace esp32m {
 
        protected:
         void handleEvent(Event &ev) override;
-        void emit(std::vector<const Sensor *> sensors) override;
+        void emit(const std::vector<const Sensor *> &sensors) override;
+        bool setConfig(const JsonVariantConst cfg,
+                       DynamicJsonDocument **result) override;
+        DynamicJsonDocument *getConfig(RequestContext &ctx) override;
 
        private:
         Mqtt(){};
         char *_sensorsTopic = nullptr;
+        LineWriter _lines;
+        // maximum size of a message, lines are never split
+        int _batchSize = 1024;
+        bool _timestamps = true;
+        void flush(size_t size);
       };
 
       static inline Mqtt *useMqtt() {
@@ -22,6 +22,14 @@ namespace esp32m {
     std::string serialize(const JsonVariantConst v);
     size_t measure(const JsonVariantConst v);
     bool checkEqual(const JsonVariantConst a, const JsonVariantConst b);
+    /**
+     * Writes RFC 7386 merge patch that turns @c from into @c to. Objects are
+     * compared member by member, anything else is replaced as a whole.
+     * Removed members are set to null in the patch.
+     * @return @c false if @c from and @c to are equal
+     */
+    bool diff(const JsonVariantConst from, const JsonVariantConst to,
+              JsonVariant patch);
 
     void checkSetResult(esp_err_t err, DynamicJsonDocument **result);
 
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "esp32m/logging.hpp"
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      struct Record {
+        std::string topic;
+        std::string payload;
+        int qos = 0;
+        bool retain = false;
+        size_t size() const {
+          return sizeof(Record) + topic.size() + payload.size();
+        }
+      };
+
+      /**
+       * Store-and-forward queue for messages produced while the broker is
+       * unreachable. Messages are kept in RAM up to the configured size; the
+       * oldest ones are then moved to a spill file in flash, if enabled, or
+       * dropped. Messages are returned in the order they were added, spilled
+       * ones first. If the spill file is full, messages that would go there
+       * are dropped, so there may be a gap, but never a reordering.
+       * The backlog is disabled until it is given a size limit.
+       */
+      class Backlog : public log::Loggable {
+       public:
+        Backlog(const char *path) : _path(path) {}
+        Backlog(const Backlog &) = delete;
+        const char *name() const override {
+          return "mqtt-backlog";
+        }
+        bool empty() const {
+          return !_count;
+        }
+        size_t count() const {
+          return _count;
+        }
+        uint32_t dropped() const {
+          return _dropped;
+        }
+        bool enabled() const {
+          return _ramLimit || _spillLimit;
+        }
+        /**
+         * @param ram maximum size of messages kept in RAM
+         * @param spill maximum size of the spill file, 0 disables spilling
+         * If both are 0, messages are dropped as they are added.
+         */
+        void setLimits(size_t ram, size_t spill);
+        void add(const char *topic, const char *payload, int qos, bool retain);
+        /**
+         * Retrieves the oldest message without removing it
+         */
+        bool peek(Record &record);
+        /**
+         * Removes the oldest message, to be called after it was sent
+         */
+        void pop();
+        void clear();
+
+       private:
+        const char *_path;
+        std::mutex _mutex;
+        std::deque<Record> _ram;
+        size_t _ramSize = 0, _ramLimit = 0, _spillLimit = 0;
+        // spill file, kept open while it holds messages
+        FILE *_file = nullptr;
+        // number of messages in the spill file and their position
+        size_t _spilled = 0, _readPos = 0, _writePos = 0;
+        // size of the record at _readPos, 0 if not read yet
+        size_t _peeked = 0;
+        size_t _count = 0;
+        uint32_t _dropped = 0;
+        void spill();
+        FILE *file();
+        bool write(FILE *file, const Record &record);
+        bool read(Record &record);
+        void unlinkSpill();
+      };
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <ArduinoJson.h>
+
+#include <mutex>
+
+#include "esp32m/device.hpp"
+#include "esp32m/net/outbox.hpp"
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      /**
+       * Throughput and latency counters of the MQTT client. Publishing side
+       * is updated by the MQTT task, receiving side and acknowledgements by
+       * the esp-mqtt client task.
+       */
+      class Metrics {
+       public:
+        // upper bounds of latency histogram buckets in milliseconds, the last
+        // bucket collects everything above
+        static constexpr uint16_t Bounds[] = {10,  25,   50,   100,
+                                              250, 500, 1000, 2500};
+        static constexpr int Buckets = sizeof(Bounds) / sizeof(Bounds[0]) + 1;
+        Metrics() {}
+        Metrics(const Metrics &) = delete;
+        /**
+         * @param id message id returned by the client, starts latency
+         * tracking for QoS > 0
+         */
+        void sent(int id, int qos, size_t bytes);
+        void acked(int id);
+        void received(size_t bytes);
+        void handled(int64_t us);
+        void disconnected();
+        void ready();
+        /**
+         * Updates rates, to be called about once a second
+         */
+        void tick();
+        void toJson(JsonObject target);
+        static constexpr size_t JsonSize =
+            JSON_OBJECT_SIZE(14) + JSON_ARRAY_SIZE(Buckets);
+        float latency() const {
+          return _latencyAvg;
+        }
+        float rxRate() const {
+          return _rxRate;
+        }
+        float txRate() const {
+          return _txRate;
+        }
+        uint32_t reconnects() const {
+          return _reconnects;
+        }
+
+       private:
+        // QoS > 0 messages waiting for acknowledgement; if there are more,
+        // the oldest are not tracked
+        static const int MaxPending = 16;
+        struct Pending {
+          int id = -1;
+          unsigned long at = 0;
+        };
+        std::mutex _mutex;
+        Pending _pending[MaxPending];
+        int _next = 0;
+        uint32_t _histogram[Buckets] = {};
+        uint32_t _latencyMax = 0, _latencySum = 0, _latencyCount = 0;
+        float _latencyAvg = 0;
+        uint64_t _tx = 0, _rx = 0, _txMark = 0, _rxMark = 0;
+        float _txRate = 0, _rxRate = 0;
+        unsigned long _tickAt = 0;
+        int64_t _handlerUs = 0, _handlerMaxUs = 0;
+        uint32_t _handled = 0;
+        uint32_t _reconnects = 0, _connects = 0;
+        unsigned long _downSince = 0, _lastDowntime = 0, _downtime = 0;
+      };
+
+      /**
+       * Exposes metrics as sensors, created only when enabled in the config
+       */
+      class MetricsDevice : public Device {
+       public:
+        MetricsDevice(Metrics &metrics, Outbox &outbox);
+        const char *name() const override {
+          return "mqtt-metrics";
+        }
+        void enable(bool enabled);
+
+       protected:
+        bool pollSensors() override;
+
+       private:
+        Metrics &_metrics;
+        Outbox &_outbox;
+        Sensor _latency, _tx, _rx, _depth, _reconnects;
+      };
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
@@ -3,12 +3,17 @@
 #include "esp32m/app.hpp"
 #include "esp32m/device.hpp"
 #include "esp32m/fs/cache.hpp"
+#include "esp32m/net/backlog.hpp"
+#include "esp32m/net/metrics.hpp"
+#include "esp32m/net/outbox.hpp"
+#include "esp32m/net/topics.hpp"
 #include "esp32m/resources.hpp"
 #include "esp32m/sleep.hpp"
 
 #include <mqtt_client.h>
 #include <mutex>
 #include <string>
+#include <string_view>
 
 namespace esp32m {
   namespace net {
@@ -49,12 +54,16 @@ namespace esp32m {
         friend class net::Mqtt;
       };
 
+      /**
+       * Published for incoming messages that no subscription handler took
+       * care of. Topic and payload are only valid during event dispatch.
+       */
       class Incoming : public Event {
        public:
-        std::string topic() const {
+        std::string_view topic() const {
           return _topic;
         }
-        std::string payload() const {
+        std::string_view payload() const {
           return _payload;
         }
         static bool is(Event &ev, const char *topic = nullptr) {
@@ -62,15 +71,29 @@ namespace esp32m {
         }
 
        private:
-        Incoming(std::string topic, std::string payload)
+        Incoming(std::string_view topic, std::string_view payload)
             : Event(Type), _topic(topic), _payload(payload) {}
-        std::string _topic, _payload;
+        std::string_view _topic, _payload;
         constexpr static const char *Type = "mqtt-incoming";
         friend class net::Mqtt;
       };
 
-      typedef std::function<void(std::string topic, std::string payload)>
+      /**
+       * Receives complete messages. Topic and payload are borrowed, they are
+       * only valid during the call and are not null-terminated.
+       */
+      typedef std::function<void(std::string_view topic,
+                                 std::string_view payload)>
           HandlerFunction;
+      /**
+       * Receives payloads piece by piece as they arrive, without reassembly
+       * and size limit. Called at least once per message; @c offset is the
+       * position of @c chunk in the payload of @c total bytes.
+       */
+      typedef std::function<void(std::string_view topic,
+                                 std::string_view chunk, size_t offset,
+                                 size_t total)>
+          StreamFunction;
 
       class Subscription {
        public:
@@ -98,6 +121,7 @@ namespace esp32m {
         int _id, _qos;
         std::string _topic;
         HandlerFunction _function;
+        StreamFunction _stream;
         friend class net::Mqtt;
       };
 
@@ -163,11 +187,12 @@ namespace esp32m {
 
        protected:
         void handleEvent(Event &ev) override;
-        void emit(std::vector<const Sensor *> sensors) override;
+        void emit(const std::vector<const Sensor *> &sensors) override;
 
        private:
         StatePublisher() {}
-        esp_err_t publish(const char *name, JsonVariantConst state);
+        esp_err_t publish(const char *name, JsonVariantConst state,
+                          Lane lane);
       };
 
     }  // namespace mqtt
@@ -190,13 +215,51 @@ namespace esp32m {
       void enable(bool value) {
         _enabled = value;
       }
+      /**
+       * Queues the message for sending by the MQTT task. Messages are sent
+       * lane by lane, at the configured rate, if any. A queued message may still be
+       * dropped: when the outbox overflows, or when the connection is lost
+       * before it is sent. Pass @c sent to learn what happened to it, it is
+       * called from the MQTT task (or from the task whose message caused an
+       * overflow) and must not block.
+       * @return @c false if not connected or the message was rejected,
+       * @c sent is not called then; @c true if the message was queued
+       */
       bool publish(const char *topic, const char *message, int qos = 0,
-                   bool retain = false);
+                   bool retain = false, Lane lane = Lane::Normal,
+                   SentFunction sent = nullptr);
       bool enqueue(const char *topic, const char *message, int qos = 0,
                    bool retain = false, bool store = false);
+      /**
+       * Publishes the message, or stores it in the backlog if the broker is
+       * not reachable and the backlog is enabled by giving it a size in the
+       * config (@c backlog.ram, @c backlog.spill). Stored messages are sent
+       * in order after reconnect,
+       * at a limited rate. While the backlog is not empty, new messages are
+       * appended to it to preserve the order. Messages that were queued but
+       * dropped from the outbox, or could not be sent, go to the backlog
+       * too.
+       * @return @c false if MQTT is disabled, or the message was rejected and
+       * the backlog is disabled
+       */
+      bool deliver(const char *topic, const char *message, int qos = 0,
+                   bool retain = false, Lane lane = Lane::Telemetry);
+      /**
+       * @return @c true if messages produced now would be stored rather
+       * than published immediately
+       */
+      bool isBacklogged() {
+        return !isReady() || !_backlog.empty();
+      }
       Subscription *subscribe(const char *topic, int qos = 0);
       Subscription *subscribe(const char *topic, HandlerFunction handler,
                               int qos = 0);
+      /**
+       * Subscribes to payloads delivered in chunks, for messages that may be
+       * larger than the reassembly buffer (config pushes, certificates etc.)
+       */
+      Subscription *subscribe(const char *topic, StreamFunction handler,
+                              int qos = 0);
       void setLwt(const char *topic, const char *message, int qos = 1,
                   bool retain = true);
       const Message &getLwt() const {
@@ -229,6 +292,21 @@ namespace esp32m {
       Status _status = Status::Initial;
       std::mutex _mutex;
       std::map<std::string, std::map<int, Subscription *> > _subscriptions;
+      // the same subscriptions, for matching incoming topics
+      mqtt::TopicTrie _trie;
+      // reused by the MQTT client task to collect matching handlers and to
+      // reassemble fragmented payloads
+      std::vector<HandlerFunction> _handlers;
+      std::vector<StreamFunction> _streams;
+      std::string _inTopic, _inPayload;
+      size_t _inTotal = 0;
+      bool _inNotify = false, _inReassemble = false;
+      // maximum size of a reassembled payload
+      int _maxPayload = 16384;
+      uint32_t _oversized = 0;
+      mqtt::Metrics _metrics;
+      std::unique_ptr<mqtt::MetricsDevice> _metricsDevice;
+      bool _metricsSensors = false;
       void setState(Status state);
 
       bool _enabled = true, _configChanged = false;
@@ -241,13 +319,42 @@ namespace esp32m {
       uint32_t _pubcnt = 0, _recvcnt = 0;
       unsigned long _timer = 0;
       int _timeout = 30;
+      mqtt::Backlog _backlog;
+      // backlog size limits in RAM and flash, and drain rate in messages/s;
+      // the backlog is off by default, as it holds RAM on devices that may
+      // never reach a broker
+      int _backlogRam = 0, _backlogSpill = 0, _backlogRate = 20;
+      mqtt::Outbox _outbox;
+      // outbox size limit, token bucket rate in messages/s and its capacity;
+      // rate 0 sends as fast as the client takes messages
+      int _outboxSize = 16384, _rate = 0, _burst = 20;
+      float _tokens = 0;
+      unsigned long _refilledAt = 0;
+      uint32_t _pubfail = 0;
       esp_err_t handle(int32_t event_id, void *event_data);
+      void receive(esp_mqtt_event_handle_t event);
+      Subscription *subscribe(Subscription *sub);
       void run();
       void disconnect();
       bool intSubscribe(std::string topic, int qos = 0);
       void unsubscribe(Subscription *sub);
       void prepareCfg(bool init);
       void publishBirth();
+      void drainBacklog();
+      void flushOutbox();
+      void refill();
+      // whether the rate limit lets another message go
+      bool canSend() const {
+        return !_rate || _tokens >= 1;
+      }
+      void spend() {
+        if (_rate)
+          _tokens -= 1;
+      }
+      int pendingWait();
+      bool send(const char *topic, const char *message, int qos, bool retain);
+      bool push(const char *topic, const char *message, int qos, bool retain,
+                Lane lane, bool store, SentFunction sent);
       const char *effectiveClient();
       friend class mqtt::Subscription;
     };
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      /**
+       * Outgoing messages are sent lane by lane, in the order listed here
+       */
+      enum class Lane {
+        // responses to requests, sent first
+        Response,
+        Normal,
+        // bulk data that may wait
+        Telemetry,
+        // same as Telemetry, but for QoS 0 messages that carry the complete
+        // state of something: a newer message replaces the queued one with
+        // the same topic
+        State,
+      };
+
+      /**
+       * Reports whether the message was handed over to the MQTT client
+       * (@c true), or dropped from the outbox (@c false)
+       */
+      typedef std::function<void(bool sent)> SentFunction;
+
+      struct Outgoing {
+        std::string topic;
+        std::string payload;
+        int qos = 0;
+        bool retain = false;
+        // keep in the backlog rather than lose it if it can't be sent
+        bool store = false;
+        SentFunction sent;
+        size_t size() const {
+          return sizeof(Outgoing) + topic.size() + payload.size();
+        }
+      };
+
+      /**
+       * Bounded queue of messages waiting to be handed over to the MQTT
+       * client. When it is full, the oldest messages of the least important
+       * lane are dropped.
+       */
+      class Outbox {
+       public:
+        typedef std::function<void(Outgoing &message)> DropFunction;
+        Outbox() {}
+        Outbox(const Outbox &) = delete;
+        /**
+         * Sets the function to be called for every message dropped from the
+         * outbox, outside of the outbox lock. It is called from the task
+         * that caused the drop.
+         */
+        void onDrop(DropFunction fn) {
+          _onDrop = fn;
+        }
+        void setLimit(size_t limit);
+        bool push(const char *topic, const char *payload, int qos,
+                  bool retain, Lane lane, bool store = false,
+                  SentFunction sent = nullptr);
+        bool pop(Outgoing &message);
+        /**
+         * Drops all messages, e.g. when the connection is lost
+         */
+        void clear();
+        bool empty() const {
+          return !_count;
+        }
+        size_t count() const {
+          return _count;
+        }
+        size_t size() const {
+          return _size;
+        }
+        uint32_t dropped() const {
+          return _dropped;
+        }
+        uint32_t coalesced() const {
+          return _coalesced;
+        }
+
+       private:
+        static const int Lanes = 3;
+        std::mutex _mutex;
+        std::deque<Outgoing> _lanes[Lanes];
+        // queued State messages by topic, deque keeps references to elements
+        // stable when adding or removing at the ends
+        std::unordered_map<std::string, Outgoing *> _states;
+        size_t _limit = 16384, _size = 0, _count = 0;
+        uint32_t _dropped = 0, _coalesced = 0;
+        DropFunction _onDrop;
+        void popFront(int lane, Outgoing &into);
+        void trim(std::vector<Outgoing> &dropped);
+        void notify(std::vector<Outgoing> &dropped);
+      };
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
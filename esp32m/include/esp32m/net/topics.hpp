@@ -0,0 +1,92 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      class Subscription;
+
+      /**
+       * Subscriptions indexed by topic filter levels, with support for MQTT
+       * wildcards: `+` matches a single level, `#` matches all remaining
+       * levels (including none). Matching a topic costs O(topic depth)
+       * rather than O(number of subscriptions).
+       */
+      class TopicTrie {
+       public:
+        void add(std::string_view filter, Subscription *sub);
+        void remove(std::string_view filter, Subscription *sub);
+        /**
+         * Calls @c f for every subscription whose filter matches @c topic
+         */
+        template <typename F>
+        void match(std::string_view topic, F f) const {
+          // topics starting with $ are not matched by wildcards at the first
+          // level, see MQTT 3.1.1 section 4.7.2
+          match(&_root, topic, !topic.empty() && topic[0] == '$', f);
+        }
+        bool empty() const {
+          return _root.children.empty() && _root.subs.empty();
+        }
+
+       private:
+        struct Node {
+          std::map<std::string, std::unique_ptr<Node>, std::less<> > children;
+          std::vector<Subscription *> subs;
+          const Node *child(std::string_view level) const {
+            auto it = children.find(level);
+            return it == children.end() ? nullptr : it->second.get();
+          }
+        };
+        Node _root;
+
+        template <typename F>
+        static void matchLast(const Node *node, F &f) {
+          for (auto sub : node->subs) f(sub);
+          // "a/#" matches "a" as well
+          auto any = node->child("#");
+          if (any)
+            for (auto sub : any->subs) f(sub);
+        }
+        template <typename F>
+        static void match(const Node *node, std::string_view rest,
+                          bool noWildcards, F &f) {
+          for (;;) {
+            if (!noWildcards) {
+              auto any = node->child("#");
+              if (any)
+                for (auto sub : any->subs) f(sub);
+            }
+            auto slash = rest.find('/');
+            auto level = rest.substr(0, slash);
+            if (!noWildcards) {
+              auto one = node->child("+");
+              if (one) {
+                if (slash == std::string_view::npos)
+                  matchLast(one, f);
+                else
+                  match(one, rest.substr(slash + 1), false, f);
+              }
+            }
+            node = node->child(level);
+            if (!node)
+              return;
+            if (slash == std::string_view::npos) {
+              matchLast(node, f);
+              return;
+            }
+            rest = rest.substr(slash + 1);
+            noWildcards = false;
+          }
+        }
+      };
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace esp32m {
+  namespace sensor {
+
+    /**
+     * Arithmetic expression over named inputs, compiled once into stack
+     * machine code and evaluated without allocations. Supports numbers,
+     * input names, parentheses, unary minus, @c + @c - @c * @c / @c ^ and
+     * functions @c abs, @c sqrt, @c ln, @c exp, @c pow, @c min, @c max.
+     * Names are made of letters, digits, @c _ and @c . and must not start with
+     * a digit, other names can be put in single quotes:
+     * @code
+     * 'ina3221-1_voltage' * 'ina3221-1_current'
+     * @endcode
+     */
+    class Expression {
+     public:
+      static constexpr int MaxStack = 16;
+      static constexpr int MaxInputs = 16;
+      Expression() {}
+      Expression(const Expression &) = delete;
+      /**
+       * Replaces current code with the one compiled from @c source
+       * @return @c false if the source is not valid, see error()
+       */
+      bool compile(const char *source);
+      bool compiled() const {
+        return !_code.empty();
+      }
+      const char *error() const {
+        return _error.c_str();
+      }
+      /**
+       * @return names of the inputs, in the order evaluate() expects them
+       */
+      const std::vector<std::string> &inputs() const {
+        return _inputs;
+      }
+      /**
+       * @param values input values, in the order of inputs()
+       * @return @c false if the result is not a finite number
+       */
+      bool evaluate(const float *values, float &result) const;
+
+     private:
+      enum class Op : uint8_t {
+        Const,
+        Input,
+        Neg,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Min,
+        Max,
+        Abs,
+        Sqrt,
+        Ln,
+        Exp
+      };
+      struct Instr {
+        Op op;
+        uint8_t index;  // into _constants or inputs
+      };
+      std::vector<Instr> _code;
+      std::vector<float> _constants;
+      std::vector<std::string> _inputs;
+      std::string _error;
+      friend class Compiler;
+    };
+
+  }  // namespace sensor
+}  // namespace esp32m
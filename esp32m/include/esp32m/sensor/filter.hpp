@@ -0,0 +1,72 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+namespace esp32m {
+  namespace sensor {
+
+    /**
+     * Stage of a sensor filter pipeline. Filters keep their state in buffers
+     * that are allocated when the filter is created, processing a sample never
+     * allocates.
+     */
+    class Filter {
+     public:
+      virtual ~Filter() {}
+      /**
+       * Processes a sample in place
+       * @return @c false if the sample must be dropped
+       */
+      virtual bool process(float &value) = 0;
+      virtual void reset() = 0;
+      /**
+       * Creates filter from its config, for example
+       * @code {"type": "median", "size": 5} @endcode
+       * @return @c nullptr if the config is not valid
+       */
+      static Filter *create(JsonObjectConst cfg);
+      // largest window any filter may keep
+      static constexpr int MaxWindow = 32;
+    };
+
+    /**
+     * Chain of filters applied to every numeric reading of a sensor, in order
+     */
+    class Pipeline {
+     public:
+      Pipeline() {}
+      Pipeline(const Pipeline &) = delete;
+      bool empty() const {
+        return _filters.empty();
+      }
+      size_t size() const {
+        return _filters.size();
+      }
+      bool process(float &value) {
+        // a failed reading would stay in the windows of the filters and
+        // poison their output until it is pushed out, it is passed as is
+        if (!isfinite(value))
+          return true;
+        for (auto &filter : _filters)
+          if (!filter->process(value))
+            return false;
+        return true;
+      }
+      void reset() {
+        for (auto &filter : _filters) filter->reset();
+      }
+      /**
+       * Creates pipeline from an array of filter configs, invalid entries are
+       * skipped
+       */
+      static Pipeline *create(JsonArrayConst cfg);
+
+     private:
+      std::vector<std::unique_ptr<Filter> > _filters;
+    };
+
+  }  // namespace sensor
+}  // namespace esp32m
@@ -3,8 +3,14 @@
 #include <ArduinoJson.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <deque>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "esp32m/app.hpp"
@@ -13,6 +19,10 @@
 #include "esp32m/ui/client.hpp"
 #include "esp32m/ui/transport.hpp"
 
+#ifndef CONFIG_ESP32M_UI_WORKERS
+#  define CONFIG_ESP32M_UI_WORKERS 2
+#endif
+
 namespace esp32m {
   namespace ui {
     class Req;
@@ -30,27 +40,87 @@ namespace esp32m {
     ui::Transport *transport() const {
       return _transport;
     }
-    std::vector<ui::Asset> &assets() {
+    /**
+     * Assets are added with addAsset(), so that they are indexed
+     */
+    const std::deque<ui::Asset> &assets() const {
       return _assets;
     }
+    /**
+     * @param uri must outlive the UI, it is used as the lookup key
+     */
     void addAsset(const char *uri, const char *contentType,
                   const uint8_t *start, const uint8_t *end,
                   const char *contentEncoding, const char *etag);
+    /**
+     * @return all encodings of the asset at @c uri, or @c nullptr
+     */
+    const std::vector<const ui::Asset *> *findAsset(std::string_view uri) const;
+    /**
+     * Queues @c fn to run on a UI worker, one at a time with the requests
+     * to the same @c target
+     * @return @c false if too many jobs are queued
+     */
+    bool schedule(const char *target, std::function<void()> fn);
     static Ui &instance();
 
    protected:
     //    bool handleRequest(Request &req) override;
     void handleEvent(Event &ev) override;
-    void wsSend(const char *text);
+    /**
+     * Queues the text for all clients. Broadcasts with the same non-null
+     * @c key replace each other in the queues of clients lagging behind.
+     */
+    void wsSend(const char *text, const char *key = nullptr);
+    /**
+     * Queues the response for the client, it is sent ahead of broadcasts
+     */
     esp_err_t wsSend(uint32_t cid, const char *text);
 
    private:
-    std::mutex _mutex, _sendMutex;
-    TaskHandle_t _task;
+    std::mutex _mutex;
+    TaskHandle_t _task, _txTask = nullptr;
+    TaskHandle_t _workers[CONFIG_ESP32M_UI_WORKERS] = {};
+    // targets of the requests being processed by the workers, and of the
+    // states being fetched for subscribers
+    std::set<std::string> _busy;
+    // client whose request was taken last
+    uint32_t _served = 0;
     ui::Transport *_transport;
     std::map<uint32_t, std::unique_ptr<ui::Client> > _clients;
-    std::vector<ui::Asset> _assets;
+    // jobs of other transports, see schedule()
+    std::deque<ui::Job> _jobs;
+    // deque keeps the addresses stable for the index
+    std::deque<ui::Asset> _assets;
+    std::unordered_map<std::string_view, std::vector<const ui::Asset *> >
+        _assetIndex;
+    // removes disconnected clients and pushes subscribed states
     void run();
+    /**
+     * Takes the next request to process, round-robin across clients, with
+     * the scheduled jobs taking a turn as if they were a client
+     */
+    bool nextJob(ui::Job &job, uint32_t &cid);
+    void work();
+    void notifyWorkers();
+    // sends queued frames, so that slow clients don't hold up the tasks
+    // that produce responses and broadcasts, nor each other
+    void transmit();
+    void notifyTx() {
+      // broadcasts may come before the task is started
+      if (_txTask)
+        xTaskNotifyGive(_txTask);
+    }
+    /**
+     * Handles subscribe-state and unsubscribe-state requests of the client
+     */
+    esp_err_t subscribeState(uint32_t cid, const char *name,
+                             JsonVariantConst target, JsonVariantConst data);
+    /**
+     * Sends state patches for due subscriptions
+     * @return milliseconds until the next subscription is due
+     */
+    int pushStates();
     void incoming(uint32_t cid, DynamicJsonDocument *json);
     void sessionClosed(uint32_t cid);
     friend class ui::Req;
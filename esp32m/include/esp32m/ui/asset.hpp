@@ -3,6 +3,11 @@
 namespace esp32m {
   namespace ui {
 
+    /**
+     * Embedded file served by the UI transport. The same URI may be added
+     * several times with different content encodings, the transport picks
+     * the variant the client accepts.
+     */
     struct Asset {
       const char *_uri;
       const char *_contentType;
@@ -18,6 +23,9 @@ namespace esp32m {
             _end(end),
             _contentEncoding(contentEncoding),
             _etag(etag) {}
+      size_t size() const {
+        return _end - _start;
+      }
     };
 
   }  // namespace ui
@@ -1,31 +1,102 @@
 #pragma once
 
+#include <atomic>
 #include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 
 #include <ArduinoJson.h>
 #include <esp32m/logging.hpp>
-#include <esp32m/ui.hpp>
 
 namespace esp32m {
   class Ui;
   namespace ui {
 
-    static bool requestsSame(DynamicJsonDocument *a, DynamicJsonDocument *b) {
-      if (!a && !b)
+    static bool requestsSame(JsonObjectConst a, JsonObjectConst b) {
+      if (a.isNull() && b.isNull())
         return true;
-      if (!a || !b)
+      if (a.isNull() || b.isNull())
         return false;
-      auto oa = a->as<JsonObjectConst>();
-      auto ob = a->as<JsonObjectConst>();
-      if (oa.isNull() && ob.isNull())
-        return true;
-      if (oa.isNull() || ob.isNull())
-        return false;
-      return oa["type"] == ob["type"] && oa["name"] == ob["name"] &&
-             oa["target"] == ob["target"];
+      return a["type"] == b["type"] && a["name"] == b["name"] &&
+             a["target"] == b["target"] && a["data"] == b["data"];
     }
 
+    /**
+     * Single request of a client. Arrays of requests are split into jobs
+     * sharing the document.
+     */
+    struct Job {
+      std::shared_ptr<DynamicJsonDocument> doc;
+      JsonObjectConst msg;
+      // requests with the same target are processed one at a time
+      std::string target;
+      // requests of other transports run this instead
+      std::function<void()> run;
+    };
+
+    /**
+     * Serialized outgoing message, shared by all clients it is queued for.
+     * Encoded forms of the text (e.g. compressed) are kept next to it, so
+     * that a broadcast is encoded once rather than once per client.
+     */
+    class Message {
+     public:
+      Message(const char *text) : _text(text) {}
+      Message(const Message &) = delete;
+      const char *c_str() const {
+        return _text.c_str();
+      }
+      size_t size() const {
+        return _text.size();
+      }
+      /**
+       * @return form of the text for the @c key, @c encode(text, out) is
+       * called to produce it on the first request. Used by the transmit
+       * task only.
+       */
+      template <typename F>
+      std::shared_ptr<const std::string> encoded(int key, F encode) const {
+        for (auto &[k, v] : _encoded)
+          if (k == key)
+            return v;
+        auto out = std::make_shared<std::string>();
+        encode(_text, *out);
+        _encoded.emplace_back(key, out);
+        return out;
+      }
+
+     private:
+      std::string _text;
+      mutable std::vector<
+          std::pair<int, std::shared_ptr<const std::string> > >
+          _encoded;
+    };
+    typedef std::shared_ptr<const Message> Frame;
+
+    enum class FrameKind { Response, Broadcast };
+
+    /**
+     * Object whose state changes are pushed to the client
+     */
+    struct StateSubscription {
+      // the state as last sent to the client, shared by all clients
+      // subscribed to the same object
+      std::shared_ptr<const DynamicJsonDocument> last;
+      // polling period in milliseconds
+      unsigned int interval = 1000;
+      unsigned long checkedAt = 0;
+      // EventStateChanged arrived since the last check
+      bool changed = true;
+      // frames dropped by the client when the last state was sent; if more
+      // were dropped since, the client may have missed a patch
+      uint32_t dropped = 0;
+    };
+
     class Client : public log::Loggable {
      public:
       Client(esp32m::Ui *ui, uint32_t id);
@@ -39,50 +110,57 @@ namespace esp32m {
       bool isDisconnected() const {
         return _disconnected;
       }
-      bool enqueue(DynamicJsonDocument *req) {
-        std::lock_guard<std::mutex> guard(_mutex);
-        // http client may open new session with the id of the previous session that was closed just before.
-        // So the new Client will not be created, but the old one will be re-used.
-        // But, this client already received disconnected() call and will be removed by the Ui thread
-        // This is a hack to prevent removal, assuming that if we got a message for this client, it is not disconnected
-        _disconnected = false; 
-        auto size = _requests.size();
-        if (size > 3) {
-          if (sameRequestInQueue(req)) {
-            logW("duplicate request");
-            return false;
-          }
-          if (size > 10) {
-            logW("too many requests");
-            return false;
-          }
-        }
-        /*char *json = json::allocSerialize(req->as<JsonVariantConst>());
-        logD("enqueue %s", json);
-        free(json);*/
-
-        _requests.push_back(std::unique_ptr<DynamicJsonDocument>(req));
-        return true;
+      /**
+       * Takes ownership of the document, which may hold a single request
+       * or an array of requests
+       * @return @c false if the request was rejected
+       */
+      bool enqueue(DynamicJsonDocument *req);
+      /**
+       * Takes the first queued request whose target is not in @c busy.
+       * Requests to the same target are taken in order, requests to other
+       * targets may overtake them.
+       */
+      bool take(const std::set<std::string> &busy, Job &job);
+      /**
+       * Queues the frame for the sender task. Responses go out before
+       * broadcasts. A broadcast replaces the queued one with the same @c key,
+       * if any. When the queue is full, the oldest broadcasts are dropped
+       * first, then the oldest responses.
+       */
+      void send(Frame frame, FrameKind kind, const char *key = nullptr);
+      Frame nextFrame();
+      uint32_t dropped() const {
+        return _dropped;
       }
-      DynamicJsonDocument *dequeue() {
-        std::lock_guard<std::mutex> guard(_mutex);
-        if (_requests.size()) {
-          DynamicJsonDocument *result = _requests.front().release();
-          _requests.pop_front();
-          return result;
-        }
-        return nullptr;
+      /**
+       * Subscriptions by object name, guarded by the UI mutex
+       */
+      std::map<std::string, StateSubscription> &subscriptions() {
+        return _subscriptions;
       }
 
      private:
+      static const size_t MaxRequests = 32;
+      static const size_t MaxFrames = 16;
+      static const size_t MaxBytes = 32768;
+      struct Outgoing {
+        Frame frame;
+        std::string key;
+      };
       std::string _name;
       bool _disconnected = false;
-      std::deque<std::unique_ptr<DynamicJsonDocument> > _requests;
-      std::mutex _mutex;
-      bool sameRequestInQueue(DynamicJsonDocument *doc) {
+      std::deque<Job> _requests;
+      std::deque<Outgoing> _responses, _broadcasts;
+      std::map<std::string, StateSubscription> _subscriptions;
+      size_t _bytes = 0;
+      // written under the send mutex, read under the UI mutex
+      std::atomic<uint32_t> _dropped = 0;
+      std::mutex _mutex, _sendMutex;
+      bool sameRequestInQueue(JsonObjectConst msg) {
         // must be called from scope guarded by mutex
-        for (auto it = _requests.begin(); it != _requests.end(); ++it)
-          if (requestsSame(it->get(), doc))
+        for (auto &job : _requests)
+          if (requestsSame(job.msg, msg))
             return true;
         return false;
       }
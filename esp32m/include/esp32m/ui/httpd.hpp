@@ -1,10 +1,23 @@
 #include <esp_http_server.h>
 
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include "esp32m/ui/transport.hpp"
 
 namespace esp32m {
   namespace ui {
 
+    struct Asset;
+    struct WsSession;
+    struct ApiPending;
+    struct AssetTransfer;
+
+    enum class Range { None, Satisfiable, Unsatisfiable };
+
     class Httpd : public Transport {
      public:
       Httpd();
@@ -19,15 +32,58 @@ namespace esp32m {
      protected:
       void init(Ui *ui) override;
       esp_err_t wsSend(uint32_t cid, const char *text) override;
+      esp_err_t sendFrame(uint32_t cid, const Frame &frame) override;
+      bool wsFlush(uint32_t cid) override;
 
      private:
       httpd_config_t _config;
       httpd_handle_t _server;
+      std::mutex _wsMutex;
+      // permessage-deflate negotiation, state and pending output by socket
+      std::map<int, std::unique_ptr<WsSession> > _ws;
+      std::mutex _apiMutex;
+      // API requests by sequence number, while waiting for a response
+      std::map<int, std::unique_ptr<ApiPending> > _api;
+      std::atomic<int> _apiSeq = 0;
+      TaskHandle_t _assetTask = nullptr;
+      std::mutex _transfersMutex;
+      // asset transfers handed over to the asset task
+      std::deque<std::unique_ptr<AssetTransfer> > _transfers;
       esp_err_t incomingReq(httpd_req_t *req);
+      esp_err_t sendAsset(httpd_req_t *req, const Asset *asset, bool varies);
+      // sends the bodies of large assets, round-robin across clients, and
+      // times out deferred API requests
+      void sendAssets();
       esp_err_t incomingWs(httpd_req_t *req);
+      esp_err_t incomingApi(httpd_req_t *req);
+      // publishes the request and waits for its response on the calling
+      // task, used where requests can't be taken over
+      esp_err_t handleApi(httpd_req_t *req, const char *name,
+                          JsonVariantConst body, const char *target);
+      // publishes a request taken over from the server task, a deferred
+      // response completes it later
+      void startApi(httpd_req_t *req, const char *name, JsonVariantConst body,
+                    const char *target);
+      // adds a pending API request, completed by the response if @c req is
+      // given, otherwise the calling task is notified
+      int registerApi(httpd_req_t *req, const char *name);
+      // completes a request taken over from the server task
+      void finishApi(httpd_req_t *req, esp_err_t result);
+      // answers API requests whose response didn't come in time
+      // @return ticks until the next one is due
+      TickType_t expireApi();
+      // appends the encoded frame to the output of the socket, and sends
+      // what the socket takes
+      esp_err_t queueFrame(uint32_t cid,
+                           std::shared_ptr<const std::string> frame);
+      friend esp_err_t apiHandler(httpd_req_t *req);
       friend esp_err_t wsHandler(httpd_req_t *req);
       friend esp_err_t httpHandler(httpd_req_t *req);
       friend void closeFn(httpd_handle_t hd, int sockfd);
+      friend int recvFn(httpd_handle_t hd, int sockfd, char *buf,
+                        size_t buf_len, int flags);
+      friend int sendFn(httpd_handle_t hd, int sockfd, const char *buf,
+                        size_t buf_len, int flags);
     };
 
   }  // namespace ui
@@ -20,6 +20,7 @@ namespace esp32m {
       char* _requestTopic = nullptr;
       char* _responseTopic = nullptr;
       Mqtt(){};
+      void request(std::string_view topic, std::string_view payload);
       void respond(const char* source, int seq, const JsonVariantConst data,
                    bool isError);
       friend class MqttRequest;
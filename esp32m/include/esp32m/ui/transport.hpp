@@ -1,6 +1,7 @@
 #pragma once
 
 #include "esp32m/logging.hpp"
+#include "esp32m/ui/client.hpp"
 
 #include <ArduinoJson.h>
 #include <esp_err.h>
@@ -13,13 +14,33 @@ namespace esp32m {
     class Transport : public log::Loggable {
      public:
       virtual ~Transport() = default;
+      /**
+       * Called by the UI transmit task only. Transports that don't block
+       * may take just a part of the frame and send the rest in wsFlush().
+       */
       virtual esp_err_t wsSend(uint32_t cid, const char *text) = 0;
+      /**
+       * Same as wsSend(), for transports that keep encoded forms of frames
+       * shared by several clients
+       */
+      virtual esp_err_t sendFrame(uint32_t cid, const Frame &frame) {
+        return wsSend(cid, frame->c_str());
+      }
+      /**
+       * Continues sending what wsSend() left over, without blocking
+       * @return @c false if the client can't take another frame yet
+       */
+      virtual bool wsFlush(uint32_t cid) {
+        return true;
+      }
 
      protected:
       Ui *_ui = nullptr;
       void incoming(uint32_t cid, void *data, size_t len);
       void incoming(uint32_t cid, DynamicJsonDocument *json);
       void sessionClosed(uint32_t cid);
+      // wakes the transmit task to send output that wsFlush() still holds
+      void outputPending();
       virtual void init(Ui *ui) {
         _ui = ui;
       };
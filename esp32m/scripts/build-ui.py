@@ -15,6 +15,11 @@ import argparse
 import subprocess
 from packaging import version
 
+try:
+    import brotli
+except ImportError:
+    brotli = None
+
 ansi_escape = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
 
 # this is to strip non-ascii chars from yarn output because ESP-IDF doesn't seem to like it
@@ -117,7 +122,7 @@ class Esp32m:
         self.package=Package(os.path.join(dir, "web-ui"))
 
 class Project:
-    def __init__(self, dir, buildDir, buildMode):
+    def __init__(self, dir, buildDir, buildMode, brotli=False):
         webUiDir=os.path.join(dir, "web-ui")
         buildWebUiDir=os.path.join(buildDir, "web-ui")
         package=Package(buildWebUiDir)
@@ -128,6 +133,7 @@ class Project:
         package.packageJson.dump()
         self.package=package
         self.buildMode=buildMode
+        self.brotli=brotli
 
     def generateResources(self):
         dir=self.package.distDir
@@ -135,19 +141,36 @@ class Project:
             os.makedirs(dir)
         types = [{'ext': 'html', 'ct': 'text/html; charset=UTF-8'},
                 {'ext': 'js', "ct": 'application/javascript'}]
+        # every encoding of a file goes to the same .S, so the list of
+        # generated sources does not depend on the encoders available
+        encoders = [('gzip', '.gz')]
+        # opt-in, so the firmware doesn't depend on what the build machine
+        # has installed
+        if self.brotli:
+            if not brotli:
+                raise Exception("brotli-encoded assets were requested, but the brotli module is not installed")
+            encoders.append(('br', '.br'))
         assets = []
         for t in types:
             for sfp in glob.glob(os.path.join(dir, "*."+t['ext'])):
-                cfp = sfp+'.gz'
-                with open(sfp, 'rb') as pf, open(cfp, 'wb') as cf, gzip.GzipFile('', mode='wb', fileobj=cf) as zf:
-                    shutil.copyfileobj(pf, zf)
-                afp = sfp+'.S'
                 name = os.path.basename(sfp)
-                bin2asm(cfp, afp, sanitizeName(name))
-                with open(cfp, 'rb') as cf:
-                    buf = cf.read()
-                assets.append(
-                    {'name': name, 'ct': t['ct'], 'ce': 'gzip', 'size': len(buf), 'hash': hashlib.sha1(buf).digest()})
+                blobs = []
+                for ce, ext in encoders:
+                    cfp = sfp+ext
+                    if ce == 'gzip':
+                        with open(sfp, 'rb') as pf, open(cfp, 'wb') as cf, gzip.GzipFile('', mode='wb', fileobj=cf) as zf:
+                            shutil.copyfileobj(pf, zf)
+                    else:
+                        with open(sfp, 'rb') as pf, open(cfp, 'wb') as cf:
+                            cf.write(brotli.compress(pf.read(), mode=brotli.MODE_TEXT, quality=11))
+                    with open(cfp, 'rb') as cf:
+                        buf = cf.read()
+                    # gzip keeps the original symbol names for compatibility
+                    symbol = sanitizeName(name if ce == 'gzip' else name+ext)
+                    blobs.append((cfp, symbol))
+                    assets.append(
+                        {'name': name, 'symbol': symbol, 'ct': t['ct'], 'ce': ce, 'size': len(buf), 'hash': hashlib.sha1(buf).digest()})
+                bin2asm(blobs, sfp+'.S')
         for name in ['main.js.S', 'index.html.S']:
             p=os.path.join(dir, name)
             n=sanitizeName(name)
@@ -161,12 +184,12 @@ class Project:
                 f.write("#pragma once\n\n")
                 f.write("namespace esp32m {\n\n")
                 for a in assets:
-                    name = sanitizeName(a['name'])
+                    name = a['symbol']
                     f.write(f'  extern "C" const uint8_t {name}_start[];\n')
                     f.write(f'  extern "C" const uint8_t {name}_end[];\n')
                 f.write("\n  static inline void initUi(Ui* ui) {\n")
                 for a in assets:
-                    name = sanitizeName(a['name'])
+                    name = a['symbol']
                     url = "/"
                     if not a['name'].startswith('index.htm'):
                         url += a['name']
@@ -202,21 +225,23 @@ def copyPackage(fromDir, toDir, level=0):
 def sanitizeName(n):
     return re.sub(r'[^a-zA-Z0-9_]', '_', n)
 
-def bin2asm(source, dest, name):
-    with open(source, 'rb') as sf, open(dest, 'w', newline='\n') as df:
-        df.write(
-            f'.data\n.section .rodata.embedded\n.global {name}_start\n{name}_start:\n')
-        while True:
-            linebuf = sf.read(16)
-            if len(linebuf) == 0:
-                break
-            line = ""
-            for x in linebuf:
-                if len(line) != 0:
-                    line += ","
-                line += (" 0x"+bytes([x]).hex())
-            df.write(".byte" + line + "\n")
-        df.write(f'.global {name}_end\n{name}_end:\n')
+def bin2asm(sources, dest):
+    with open(dest, 'w', newline='\n') as df:
+        df.write('.data\n.section .rodata.embedded\n')
+        for source, name in sources:
+            with open(source, 'rb') as sf:
+                df.write(f'.global {name}_start\n{name}_start:\n')
+                while True:
+                    linebuf = sf.read(16)
+                    if len(linebuf) == 0:
+                        break
+                    line = ""
+                    for x in linebuf:
+                        if len(line) != 0:
+                            line += ","
+                        line += (" 0x"+bytes([x]).hex())
+                    df.write(".byte" + line + "\n")
+                df.write(f'.global {name}_end\n{name}_end:\n')
 
 def main():
     logging.basicConfig(
@@ -226,10 +251,11 @@ def main():
     parser.add_argument("--source-dir", dest="sourceDir", required=True, help="project root")
     parser.add_argument("--build-dir", dest="buildDir", required=True, help="destination directory for the compiled UI files")
     parser.add_argument("--build-mode", dest="buildMode", required=True, help="UI build mode", type=int)
+    parser.add_argument("--brotli", action="store_true", help="embed brotli-encoded assets next to the gzip-encoded ones")
     args = parser.parse_args()
     esp32m=Esp32m(args.esp32mDir)
     buildMode=BuildMode(args.buildMode)
-    project=Project(args.sourceDir, args.buildDir, buildMode)
+    project=Project(args.sourceDir, args.buildDir, buildMode, args.brotli)
     buildUi=False
     if buildMode==BuildMode.Full:
         buildUi=True
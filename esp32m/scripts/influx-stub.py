@@ -0,0 +1,214 @@
+import re
+import sys
+import gzip
+import json
+import time
+import random
+import logging
+import argparse
+import threading
+import urllib.error
+import urllib.parse
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+Description = """
+Local stand-in for the InfluxDB v2 write endpoint, to exercise
+integrations::influx::Http without a real database or a broker. Accepts
+POST /api/v2/write with plain or gzip encoded line protocol, validates it,
+and can inject failures and delays to exercise the retry queue and the
+backoff. With --self-test, posts a few batches to itself to check the
+stand-in.
+"""
+
+# measurement[,tag=value...] field=value[,field=value...] [timestamp]
+# commas, spaces and equal signs may be escaped with a backslash
+Token = r'(?:[^\s,=\\"]|\\.)+'
+Field = Token + r'=(?:"(?:[^"\\]|\\.)*"|[-+0-9.eE]+[iu]?|[tTfF]\w*)'
+LinePattern = re.compile(
+    r'^' + Token + r'(?:,' + Token + r'=' + Token + r')*'
+    r' ' + Field + r'(?:,' + Field + r')*'
+    r'(?: -?\d+)?$')
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.writes = 0
+        self.failed = 0
+        self.rejected = 0
+        self.points = 0
+        self.bytes = 0
+        self.wireBytes = 0
+        self.measurements = {}
+
+    def summary(self):
+        with self.lock:
+            return {
+                "writes": self.writes, "failed": self.failed,
+                "rejected": self.rejected, "points": self.points,
+                "bytes": self.bytes, "wire_bytes": self.wireBytes,
+                "measurements": dict(self.measurements),
+            }
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        logging.debug(format % args)
+
+    def reply(self, status, message=None, headers={}):
+        body = json.dumps({"code": "invalid", "message": message}).encode() \
+            if message else b""
+        self.send_response(status)
+        for k, v in headers.items():
+            self.send_header(k, v)
+        if body:
+            self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        args, stats = self.server.args, self.server.stats
+        url = urllib.parse.urlsplit(self.path)
+        length = int(self.headers.get("Content-Length", 0))
+        data = self.rfile.read(length)
+        if url.path != "/api/v2/write":
+            return self.reply(404, "not found")
+        query = urllib.parse.parse_qs(url.query)
+        if not query.get("bucket"):
+            return self.reply(400, "bucket is required")
+        if args.token and self.headers.get("Authorization") != "Token " + args.token:
+            return self.reply(401, "unauthorized access")
+        with stats.lock:
+            stats.writes += 1
+            inject = stats.writes <= args.fail or random.random() < args.failRate
+            if inject:
+                stats.failed += 1
+        if args.delay:
+            time.sleep(args.delay)
+        if inject:
+            logging.info(f"write {stats.writes}: injected status {args.status}")
+            headers = {"Retry-After": str(args.retryAfter)} if args.retryAfter else {}
+            return self.reply(args.status, "injected failure", headers)
+        if self.headers.get("Content-Encoding") == "gzip":
+            try:
+                text = gzip.decompress(data)
+            except Exception as e:
+                return self.reject(f"bad gzip body: {e}")
+        else:
+            text = data
+        try:
+            lines = [l for l in text.decode().split("\n") if l]
+        except UnicodeDecodeError:
+            return self.reject("body is not utf-8")
+        for i, line in enumerate(lines):
+            if not LinePattern.match(line):
+                return self.reject(f"line {i + 1}: unable to parse '{line}'")
+        with stats.lock:
+            stats.points += len(lines)
+            stats.bytes += len(text)
+            stats.wireBytes += len(data)
+            for line in lines:
+                m = re.match(r'(?:[^\s,\\]|\\.)+', line).group(0)
+                stats.measurements[m] = stats.measurements.get(m, 0) + 1
+        logging.info(f"write {stats.writes}: {len(lines)} points,"
+                     f" {len(data)} bytes on the wire, {len(text)} uncompressed")
+        if args.out:
+            with open(args.out, "a") as f:
+                f.write("\n".join(lines) + "\n")
+        self.reply(204)
+
+    def reject(self, message):
+        with self.server.stats.lock:
+            self.server.stats.rejected += 1
+        logging.warning(message)
+        self.reply(400, message)
+
+
+def selfTest(port, args):
+    url = f"http://127.0.0.1:{port}/api/v2/write?org=esp32m&bucket=test&precision=ns"
+    batch = "\n".join(f"temp,host=emulated,sensor=t{i} value={20 + i / 10},raw={i}i"
+                      f" {time.time_ns()}" for i in range(50)).encode()
+    headers = {"Content-Type": "text/plain; charset=utf-8",
+               "Content-Encoding": "gzip"}
+    if args.token:
+        headers["Authorization"] = "Token " + args.token
+    backoff, delivered = 0.1, 0
+    for _ in range(args.fail + 3):
+        req = urllib.request.Request(url, gzip.compress(batch), headers)
+        try:
+            with urllib.request.urlopen(req, timeout=5) as r:
+                delivered = r.status == 204
+                break
+        except urllib.error.HTTPError as e:
+            logging.info(f"self-test: status {e.code}, retrying in {backoff}s")
+            time.sleep(backoff)
+            backoff *= 2
+    headers.pop("Content-Encoding")
+    req = urllib.request.Request(url, b"temp value=\n", headers)
+    try:
+        urllib.request.urlopen(req, timeout=5)
+        malformed = False
+    except urllib.error.HTTPError as e:
+        malformed = e.code == 400
+    return delivered and malformed
+
+
+def main():
+    logging.basicConfig(
+        format='esp32m-influx-stub:%(levelname)s:%(message)s', level=logging.INFO)
+    parser = argparse.ArgumentParser(description=Description)
+    parser.add_argument("--bind", default="0.0.0.0", help="address to listen on")
+    parser.add_argument("--port", type=int, default=8086, help="port, 0 to pick a free one")
+    parser.add_argument("--token", help="require this API token")
+    parser.add_argument("--fail", type=int, default=0, help="fail this many writes first")
+    parser.add_argument("--fail-rate", dest="failRate", type=float, default=0,
+                        help="fail this fraction of writes at random")
+    parser.add_argument("--status", type=int, default=503, help="status for failed writes")
+    parser.add_argument("--retry-after", dest="retryAfter", type=int,
+                        help="Retry-After header for failed writes, seconds")
+    parser.add_argument("--delay", type=float, default=0, help="delay every response, seconds")
+    parser.add_argument("--duration", type=float, help="stop after this time, seconds")
+    parser.add_argument("--min-points", dest="minPoints", type=int,
+                        help="fail if fewer points were accepted")
+    parser.add_argument("--out", help="append accepted lines to this file")
+    parser.add_argument("--json", help="write stats to this file")
+    parser.add_argument("--self-test", dest="selfTest", action="store_true",
+                        help="post a few batches to the stand-in itself")
+    args = parser.parse_args()
+    if args.selfTest:
+        args.bind = "127.0.0.1"
+    server = ThreadingHTTPServer((args.bind, 0 if args.selfTest else args.port), Handler)
+    server.args, server.stats = args, Stats()
+    port = server.server_address[1]
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    logging.info(f"listening on {args.bind}:{port}")
+    ok = True
+    try:
+        if args.selfTest:
+            ok = selfTest(port, args)
+        elif args.duration:
+            time.sleep(args.duration)
+        else:
+            while True:
+                time.sleep(3600)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.shutdown()
+    stats = server.stats.summary()
+    print(json.dumps(stats, indent=2))
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(stats, f, indent=2)
+    if args.minPoints is not None and stats["points"] < args.minPoints:
+        logging.error(f"{stats['points']} points accepted, expected at least {args.minPoints}")
+        ok = False
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,634 @@
+import sys
+import json
+import time
+import random
+import struct
+import asyncio
+import logging
+import argparse
+import statistics
+
+Description = """
+Minimal MQTT 3.1.1 broker with load scenarios for the esp32m MQTT stack.
+The broker runs in-process, the benchmark observes and injects messages
+directly, without a client connection of its own. The device under test
+is either real hardware or QEMU pointed at this host, or, with --self-test,
+an emulated device speaking the same topics over a local TCP connection.
+"""
+
+CONNECT, CONNACK, PUBLISH, PUBACK, PUBREC, PUBREL, PUBCOMP = range(1, 8)
+SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK, PINGREQ, PINGRESP, DISCONNECT = range(8, 15)
+
+
+def encodeLength(n):
+    out = bytearray()
+    while True:
+        b = n % 128
+        n //= 128
+        out.append(b | 0x80 if n else b)
+        if not n:
+            return bytes(out)
+
+
+def encodeString(s):
+    if isinstance(s, str):
+        s = s.encode()
+    return struct.pack("!H", len(s)) + s
+
+
+def packet(type, flags, body):
+    return bytes([type << 4 | flags]) + encodeLength(len(body)) + body
+
+
+async def readPacket(reader):
+    header = await reader.readexactly(1)
+    length, shift = 0, 0
+    while True:
+        b = (await reader.readexactly(1))[0]
+        length |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            break
+        if shift > 21:
+            raise ValueError("malformed remaining length")
+    body = await reader.readexactly(length) if length else b""
+    return header[0] >> 4, header[0] & 0x0F, body
+
+
+def readString(body, pos):
+    (n,) = struct.unpack_from("!H", body, pos)
+    return body[pos + 2:pos + 2 + n], pos + 2 + n
+
+
+def topicMatches(filter, topic):
+    # topics starting with $ are not matched by wildcards at the first level
+    if topic.startswith("$") and filter[:1] in ("+", "#"):
+        return False
+    f = filter.split("/")
+    t = topic.split("/")
+    for i, level in enumerate(f):
+        if level == "#":
+            return True
+        if i >= len(t):
+            return False
+        if level != "+" and level != t[i]:
+            return False
+    return len(f) == len(t)
+
+
+class Session:
+    def __init__(self, broker, reader, writer):
+        self.broker = broker
+        self.reader = reader
+        self.writer = writer
+        self.clientId = None
+        self.subscriptions = {}
+        self.will = None
+        self.nextId = 0
+
+    def send(self, data):
+        if not self.writer.is_closing():
+            self.writer.write(data)
+
+    def deliver(self, topic, payload, qos, retain=False):
+        flags = (1 if retain else 0) | (qos << 1)
+        body = encodeString(topic)
+        if qos:
+            self.nextId = self.nextId % 0xFFFF + 1
+            body += struct.pack("!H", self.nextId)
+        self.send(packet(PUBLISH, flags, body + payload))
+
+    async def run(self):
+        graceful = False
+        try:
+            while True:
+                type, flags, body = await readPacket(self.reader)
+                if type == CONNECT:
+                    self.connect(body)
+                elif type == PUBLISH:
+                    qos = (flags >> 1) & 3
+                    topic, pos = readString(body, 0)
+                    if qos:
+                        (id,) = struct.unpack_from("!H", body, pos)
+                        pos += 2
+                        self.send(packet(PUBACK if qos == 1 else PUBREC, 0, struct.pack("!H", id)))
+                    self.broker.publish(topic.decode(), body[pos:], qos, bool(flags & 1), self)
+                elif type == PUBREL:
+                    self.send(packet(PUBCOMP, 0, body[:2]))
+                elif type == SUBSCRIBE:
+                    self.subscribe(body)
+                elif type == UNSUBSCRIBE:
+                    pos = 2
+                    while pos < len(body):
+                        filter, pos = readString(body, pos)
+                        self.subscriptions.pop(filter.decode(), None)
+                    self.send(packet(UNSUBACK, 0, body[:2]))
+                elif type == PINGREQ:
+                    self.send(packet(PINGRESP, 0, b""))
+                elif type == DISCONNECT:
+                    graceful = True
+                    break
+                await self.writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionError, ValueError):
+            pass
+        except asyncio.CancelledError:
+            # broker is shutting down
+            pass
+        finally:
+            self.broker.closed(self, graceful)
+            self.writer.close()
+
+    def connect(self, body):
+        _, pos = readString(body, 0)
+        flags = body[pos + 1]
+        pos += 4
+        clientId, pos = readString(body, pos)
+        self.clientId = clientId.decode()
+        if flags & 0x04:
+            topic, pos = readString(body, pos)
+            message, pos = readString(body, pos)
+            self.will = (topic.decode(), message, (flags >> 3) & 3, bool(flags & 0x20))
+        self.send(packet(CONNACK, 0, b"\x00\x00"))
+        self.broker.connected(self)
+
+    def subscribe(self, body):
+        pos = 2
+        granted = bytearray()
+        filters = []
+        while pos < len(body):
+            filter, pos = readString(body, pos)
+            qos = min(body[pos], 1)
+            pos += 1
+            self.subscriptions[filter.decode()] = qos
+            filters.append(filter.decode())
+            granted.append(qos)
+        self.send(packet(SUBACK, 0, body[:2] + bytes(granted)))
+        for filter in filters:
+            self.broker.sendRetained(self, filter)
+
+
+class Broker:
+    def __init__(self):
+        self.sessions = set()
+        self.retained = {}
+        self.listeners = []
+        # session that set each retained message, to find the device
+        self.retainedBy = {}
+        self.server = None
+
+    async def start(self, host, port):
+        self.server = await asyncio.start_server(self.accept, host, port)
+        addr = self.server.sockets[0].getsockname()
+        logging.info(f"broker listening on {addr[0]}:{addr[1]}")
+        return addr[1]
+
+    async def stop(self):
+        for s in list(self.sessions):
+            s.writer.close()
+        self.server.close()
+        await self.server.wait_closed()
+
+    async def accept(self, reader, writer):
+        await Session(self, reader, writer).run()
+
+    def connected(self, session):
+        for s in list(self.sessions):
+            if s.clientId == session.clientId:
+                # taken over by the new connection, no will message
+                self.sessions.discard(s)
+                s.writer.close()
+        self.sessions.add(session)
+        logging.info(f"client connected: {session.clientId}")
+
+    def closed(self, session, graceful):
+        if session not in self.sessions:
+            return
+        self.sessions.discard(session)
+        logging.info(f"client disconnected: {session.clientId}")
+        if session.will and not graceful:
+            self.publish(*session.will)
+
+    def kick(self, session):
+        if session in self.sessions:
+            session.writer.close()
+
+    def listen(self, filter, callback):
+        """in-process subscription, callback(topic, payload, receivedAt)"""
+        entry = (filter, callback)
+        self.listeners.append(entry)
+        return lambda: self.listeners.remove(entry)
+
+    def publish(self, topic, payload, qos=0, retain=False, origin=None):
+        now = time.perf_counter()
+        if isinstance(payload, str):
+            payload = payload.encode()
+        if retain:
+            if payload:
+                self.retained[topic] = (payload, qos)
+                self.retainedBy[topic] = origin
+            else:
+                self.retained.pop(topic, None)
+                self.retainedBy.pop(topic, None)
+        for filter, callback in list(self.listeners):
+            if topicMatches(filter, topic):
+                callback(topic, payload, now)
+        for s in list(self.sessions):
+            granted = [q for f, q in s.subscriptions.items() if topicMatches(f, topic)]
+            if granted:
+                s.deliver(topic, payload, min(qos, max(granted)))
+
+    def sendRetained(self, session, filter):
+        for topic, (payload, qos) in self.retained.items():
+            if topicMatches(filter, topic):
+                session.deliver(topic, payload, min(qos, session.subscriptions[filter]), True)
+
+
+class Client:
+    """Just enough of an MQTT client to emulate the device"""
+
+    def __init__(self, clientId):
+        self.clientId = clientId
+        self.handlers = []
+        self.reader = self.writer = None
+        self.nextId = 0
+
+    async def connect(self, host, port, will=None):
+        self.reader, self.writer = await asyncio.open_connection(host, port)
+        flags = 0x02
+        payload = encodeString(self.clientId)
+        if will:
+            flags |= 0x04 | 0x20 | (1 << 3)
+            payload += encodeString(will[0]) + encodeString(will[1])
+        body = encodeString("MQTT") + bytes([4, flags]) + struct.pack("!H", 60) + payload
+        self.writer.write(packet(CONNECT, 0, body))
+        type, _, body = await readPacket(self.reader)
+        if type != CONNACK or body[1] != 0:
+            raise ConnectionError("connection refused")
+
+    def subscribe(self, filter, handler):
+        self.nextId = self.nextId % 0xFFFF + 1
+        body = struct.pack("!H", self.nextId) + encodeString(filter) + b"\x00"
+        self.writer.write(packet(SUBSCRIBE, 2, body))
+        self.handlers.append((filter, handler))
+
+    def publish(self, topic, payload, qos=0, retain=False):
+        if isinstance(payload, str):
+            payload = payload.encode()
+        body = encodeString(topic)
+        if qos:
+            self.nextId = self.nextId % 0xFFFF + 1
+            body += struct.pack("!H", self.nextId)
+        self.writer.write(packet(PUBLISH, (qos << 1) | (1 if retain else 0), body + payload))
+
+    async def run(self):
+        try:
+            while True:
+                type, flags, body = await readPacket(self.reader)
+                if type != PUBLISH:
+                    continue
+                topic, pos = readString(body, 0)
+                if flags & 0x06:
+                    pos += 2
+                for filter, handler in self.handlers:
+                    if topicMatches(filter, topic.decode()):
+                        handler(topic.decode(), body[pos:])
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+
+
+class EmulatedDevice:
+    """
+    Speaks the same topics as esp32m: answers requests like ui::Mqtt,
+    publishes object state like StatePublisher, sensor readings like
+    influx::Mqtt and log lines like log::Mqtt. Reconnects when kicked.
+    """
+
+    def __init__(self, hostname, port, rate):
+        self.hostname = hostname
+        self.port = port
+        self.rate = rate
+        self.client = None
+
+    async def run(self):
+        prefix = f"esp32m/request/{self.hostname}/"
+        availability = f"esp32m/{self.hostname}/availability"
+        counter = 0
+        while True:
+            client = Client(self.hostname)
+            try:
+                await client.connect("127.0.0.1", self.port, (availability, "offline"))
+            except OSError:
+                await asyncio.sleep(0.5)
+                continue
+
+            def request(topic, payload, client=client):
+                target = topic[len(prefix):].split("/")[0]
+                client.publish(f"esp32m/response/{self.hostname}/{target}",
+                               json.dumps({"uptime": time.monotonic(), "heap": random.randint(100000, 120000)}))
+
+            client.subscribe(prefix + "#", request)
+            client.publish(availability, "online", 1, True)
+            self.client = client
+            reader = asyncio.ensure_future(client.run())
+            while not reader.done():
+                counter += 1
+                kind = counter % 4
+                if kind == 0:
+                    client.publish(f"esp32m/{self.hostname}/esp32/state", json.dumps({"heap": random.randint(0, 1 << 17)}))
+                elif kind == 1:
+                    client.publish(f"esp32m/sensor/{self.hostname}", f"esp32,id=temperature value={random.random() * 40:.2f}")
+                elif kind == 2:
+                    client.publish(f"esp32m/{self.hostname}/bme280/state", json.dumps({"temperature": random.random() * 40}))
+                else:
+                    client.publish(f"esp32m/log/{self.hostname}", f"I esp32: tick {counter}")
+                await asyncio.sleep(1 / self.rate)
+            await asyncio.sleep(0.2)
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def latencyStats(samples):
+    if not samples:
+        return {"count": 0}
+    return {
+        "count": len(samples),
+        "min": min(samples),
+        "avg": statistics.fmean(samples),
+        "p50": percentile(samples, 50),
+        "p95": percentile(samples, 95),
+        "p99": percentile(samples, 99),
+        "max": max(samples),
+    }
+
+
+class Bench:
+    def __init__(self, broker, hostname, args):
+        self.broker = broker
+        self.hostname = hostname
+        self.args = args
+        self.requestPrefix = f"esp32m/request/{hostname}"
+        self.responsePrefix = f"esp32m/response/{hostname}"
+
+    async def roundtrip(self):
+        """sequential requests, one in flight at a time"""
+        samples, timeouts = [], 0
+        for _ in range(self.args.requests):
+            rtt = await self.request(self.args.target, "state-get")
+            if rtt is None:
+                timeouts += 1
+            else:
+                samples.append(rtt)
+        return {"rtt_ms": latencyStats(samples), "timeouts": timeouts}
+
+    async def request(self, target, name, payload=""):
+        done = asyncio.get_running_loop().create_future()
+        unlisten = self.broker.listen(
+            f"{self.responsePrefix}/{target}/#",
+            lambda topic, payload, at: done.done() or done.set_result(at))
+        started = time.perf_counter()
+        self.broker.publish(f"{self.requestPrefix}/{target}/{name}", payload)
+        try:
+            at = await asyncio.wait_for(done, self.args.timeout)
+            return (at - started) * 1000
+        except asyncio.TimeoutError:
+            return None
+        finally:
+            unlisten()
+
+    async def burst(self):
+        """many requests at once, measures how the response lane keeps up"""
+        count = self.args.burst
+        arrivals = []
+        complete = asyncio.get_running_loop().create_future()
+
+        def response(topic, payload, at):
+            arrivals.append(at)
+            if len(arrivals) == count and not complete.done():
+                complete.set_result(None)
+
+        unlisten = self.broker.listen(f"{self.responsePrefix}/{self.args.target}/#", response)
+        started = time.perf_counter()
+        for _ in range(count):
+            self.broker.publish(f"{self.requestPrefix}/{self.args.target}/state-get", "")
+        try:
+            await asyncio.wait_for(complete, self.args.timeout + count * 0.05)
+        except asyncio.TimeoutError:
+            pass
+        finally:
+            unlisten()
+        elapsed = (arrivals[-1] - started) if arrivals else None
+        return {
+            "sent": count,
+            "received": len(arrivals),
+            "rtt_ms": latencyStats([(a - started) * 1000 for a in arrivals]),
+            "rate": len(arrivals) / elapsed if elapsed else 0,
+        }
+
+    def classify(self, topic):
+        h = self.hostname
+        if topic.startswith(f"esp32m/sensor/{h}"):
+            return "sensor"
+        if topic.startswith(f"esp32m/log/{h}"):
+            return "log"
+        if topic.startswith(self.responsePrefix + "/"):
+            return "response"
+        if topic.startswith(f"esp32m/{h}/") and topic.endswith("/state"):
+            return "state"
+        return "other"
+
+    async def telemetry(self):
+        """passive observation of everything the device publishes"""
+        counts = {}
+
+        def message(topic, payload, at):
+            if topic.startswith(self.requestPrefix + "/"):
+                return
+            c = counts.setdefault(self.classify(topic), {"messages": 0, "bytes": 0})
+            c["messages"] += 1
+            c["bytes"] += len(topic) + len(payload)
+
+        unlisten = self.broker.listen("#", message)
+        started = time.perf_counter()
+        await asyncio.sleep(self.args.duration)
+        elapsed = time.perf_counter() - started
+        unlisten()
+        total = sum(c["messages"] for c in counts.values())
+        for c in counts.values():
+            c["rate"] = c["messages"] / elapsed
+        return {"duration": elapsed, "messages": total, "rate": total / elapsed,
+                "bytes_rate": sum(c["bytes"] for c in counts.values()) / elapsed,
+                "topics": counts}
+
+    async def reconnect(self):
+        """drops the device connection and measures recovery"""
+        topic = f"esp32m/{self.hostname}/availability"
+        session = self.broker.retainedBy.get(topic)
+        if not session:
+            return {"reconnect_ms": None, "error": "birth message was not retained"}
+        back = asyncio.get_running_loop().create_future()
+        unlisten = self.broker.listen(
+            topic,
+            lambda topic, payload, at: payload == b"online" and not back.done() and back.set_result(at))
+        started = time.perf_counter()
+        self.broker.kick(session)
+        try:
+            at = await asyncio.wait_for(back, self.args.timeout * 10)
+            recovered = (at - started) * 1000
+        except asyncio.TimeoutError:
+            recovered = None
+        finally:
+            unlisten()
+        # messages held back while disconnected are drained right after
+        result = {"reconnect_ms": recovered}
+        if recovered is not None:
+            rtt = await self.request(self.args.target, "state-get")
+            result["first_rtt_ms"] = rtt
+        return result
+
+
+Scenarios = ["roundtrip", "burst", "telemetry", "reconnect"]
+
+
+async def waitForDevice(broker, hostname, timeout):
+    found = asyncio.get_running_loop().create_future()
+
+    def availability(topic, payload, at):
+        name = topic.split("/")[1]
+        if payload == b"online" and (not hostname or name == hostname) and not found.done():
+            found.set_result(name)
+
+    unlisten = broker.listen("esp32m/+/availability", availability)
+    for topic, (payload, _) in list(broker.retained.items()):
+        if topicMatches("esp32m/+/availability", topic):
+            availability(topic, payload, 0)
+    try:
+        return await asyncio.wait_for(found, timeout)
+    finally:
+        unlisten()
+
+
+def check(results, args):
+    failures = []
+    rt = results.get("roundtrip")
+    if rt:
+        p95 = rt["rtt_ms"].get("p95")
+        if args.maxRttP95 and (p95 is None or p95 > args.maxRttP95):
+            failures.append(f"roundtrip p95 {p95} ms exceeds {args.maxRttP95} ms")
+        if rt["timeouts"] > args.maxTimeouts:
+            failures.append(f"{rt['timeouts']} request timeouts")
+    b = results.get("burst")
+    if b and b["received"] < b["sent"]:
+        failures.append(f"burst: {b['sent'] - b['received']} responses missing")
+    t = results.get("telemetry")
+    if t and args.minRate and t["rate"] < args.minRate:
+        failures.append(f"telemetry rate {t['rate']:.1f} msg/s below {args.minRate}")
+    r = results.get("reconnect")
+    if r and r["reconnect_ms"] is None:
+        failures.append("device did not reconnect")
+    return failures
+
+
+def report(results):
+    def fmt(v):
+        return "-" if v is None else f"{v:.1f}"
+    for name, r in results.items():
+        if "rtt_ms" in r:
+            s = r["rtt_ms"]
+            line = f"{name:10} rtt ms: n={s['count']}"
+            if s["count"]:
+                line += f" min={fmt(s['min'])} avg={fmt(s['avg'])} p50={fmt(s['p50'])}"
+                line += f" p95={fmt(s['p95'])} p99={fmt(s['p99'])} max={fmt(s['max'])}"
+            if "timeouts" in r:
+                line += f" timeouts={r['timeouts']}"
+            if "rate" in r:
+                line += f" received={r['received']}/{r['sent']} rate={fmt(r['rate'])}/s"
+            print(line)
+        elif name == "telemetry":
+            print(f"{name:10} {r['messages']} messages in {r['duration']:.1f}s,"
+                  f" {r['rate']:.1f} msg/s, {r['bytes_rate']:.0f} B/s")
+            for topic, c in sorted(r["topics"].items()):
+                print(f"{'':10}   {topic:8} {c['messages']:6} msgs {c['rate']:8.1f}/s {c['bytes']:8} B")
+        elif name == "reconnect":
+            print(f"{name:10} back online in {fmt(r['reconnect_ms'])} ms,"
+                  f" first request {fmt(r.get('first_rtt_ms'))} ms")
+
+
+async def run(args):
+    broker = Broker()
+    port = await broker.start(args.bind, args.port)
+    tasks = []
+    if args.selfTest:
+        device = EmulatedDevice(args.hostname or "emulated", port, args.emulatedRate)
+        tasks.append(asyncio.ensure_future(device.run()))
+    try:
+        logging.info("waiting for the device to come online")
+        hostname = await waitForDevice(broker, args.hostname, args.wait)
+        logging.info(f"device online: {hostname}")
+        # give the device a moment to subscribe after the birth message
+        await asyncio.sleep(args.settle)
+        bench = Bench(broker, hostname, args)
+        results = {}
+        for name in args.scenarios:
+            logging.info(f"running scenario {name}")
+            results[name] = await getattr(bench, name)()
+        return hostname, results
+    finally:
+        for t in tasks:
+            t.cancel()
+        await broker.stop()
+
+
+def main():
+    logging.basicConfig(
+        format='esp32m-mqtt-bench:%(levelname)s:%(message)s', level=logging.INFO)
+    parser = argparse.ArgumentParser(description=Description)
+    parser.add_argument("--bind", default="0.0.0.0", help="address for the broker to listen on")
+    parser.add_argument("--port", type=int, default=1883, help="broker port, 0 to pick a free one")
+    parser.add_argument("--hostname", help="device to wait for, the first one to come online by default")
+    parser.add_argument("--scenario", dest="scenarios", action="append", choices=Scenarios,
+                        help="scenario to run, may be repeated; all by default")
+    parser.add_argument("--target", default="mqtt", help="object to send requests to")
+    parser.add_argument("--requests", type=int, default=100, help="number of roundtrip requests")
+    parser.add_argument("--burst", type=int, default=20, help="number of requests sent at once")
+    parser.add_argument("--duration", type=float, default=10, help="telemetry observation time, seconds")
+    parser.add_argument("--timeout", type=float, default=5, help="response timeout, seconds")
+    parser.add_argument("--wait", type=float, default=120, help="time to wait for the device, seconds")
+    parser.add_argument("--settle", type=float, default=1, help="delay after the device comes online, seconds")
+    parser.add_argument("--self-test", dest="selfTest", action="store_true",
+                        help="run against an emulated device, to check the harness itself")
+    parser.add_argument("--emulated-rate", dest="emulatedRate", type=float, default=100,
+                        help="telemetry messages/s published by the emulated device")
+    parser.add_argument("--json", help="write results to this file")
+    parser.add_argument("--max-rtt-p95", dest="maxRttP95", type=float, help="fail if roundtrip p95 exceeds this, ms")
+    parser.add_argument("--max-timeouts", dest="maxTimeouts", type=int, default=0, help="fail on more request timeouts")
+    parser.add_argument("--min-rate", dest="minRate", type=float, help="fail if telemetry is slower, messages/s")
+    args = parser.parse_args()
+    if not args.scenarios:
+        args.scenarios = Scenarios
+    if args.selfTest:
+        args.bind = "127.0.0.1"
+    try:
+        hostname, results = asyncio.run(run(args))
+    except asyncio.TimeoutError:
+        logging.error("device did not come online")
+        sys.exit(2)
+    report(results)
+    failures = check(results, args)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({"hostname": hostname, "results": results, "failures": failures}, f, indent=2)
+    for f in failures:
+        logging.error(f)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
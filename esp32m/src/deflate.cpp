@@ -0,0 +1,353 @@
+#include "esp32m/deflate.hpp"
+
+#include <esp_rom_crc.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+namespace esp32m {
+  namespace deflate {
+
+    namespace {
+
+      const uint16_t LengthBase[] = {3,  4,  5,  6,  7,  8,  9,  10,
+                                     11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115,
+                                     131, 163, 195, 227, 258};
+      const uint8_t LengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                     1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                     4, 4, 4, 4, 5, 5, 5, 5, 0};
+      const uint16_t DistanceBase[] = {
+          1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+          33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+          1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+      const uint8_t DistanceExtra[] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                       4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+      const int MinMatch = 3;
+      const int MaxMatch = 258;
+      const int HashBits = 10;
+
+      class BitWriter {
+       public:
+        BitWriter(std::string &out) : _out(out) {}
+        // writes bits LSB first, as DEFLATE expects for everything except
+        // Huffman codes
+        void put(uint32_t bits, int count) {
+          _acc |= bits << _count;
+          _count += count;
+          while (_count >= 8) {
+            _out += (char)(_acc & 0xff);
+            _acc >>= 8;
+            _count -= 8;
+          }
+        }
+        // Huffman codes are packed starting with the most significant bit
+        void putCode(uint32_t code, int count) {
+          uint32_t reversed = 0;
+          for (int i = 0; i < count; i++, code >>= 1)
+            reversed = (reversed << 1) | (code & 1);
+          put(reversed, count);
+        }
+        void align() {
+          if (_count)
+            put(0, 8 - _count);
+        }
+
+       private:
+        std::string &_out;
+        uint32_t _acc = 0;
+        int _count = 0;
+      };
+
+      // fixed literal/length code, RFC 1951 section 3.2.6
+      void putSymbol(BitWriter &w, int symbol) {
+        if (symbol < 144)
+          w.putCode(0x30 + symbol, 8);
+        else if (symbol < 256)
+          w.putCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+          w.putCode(symbol - 256, 7);
+        else
+          w.putCode(0xc0 + symbol - 280, 8);
+      }
+
+      void putMatch(BitWriter &w, int length, int distance) {
+        int code = sizeof(LengthBase) / sizeof(LengthBase[0]) - 1;
+        while (LengthBase[code] > length) code--;
+        putSymbol(w, 257 + code);
+        w.put(length - LengthBase[code], LengthExtra[code]);
+        code = sizeof(DistanceBase) / sizeof(DistanceBase[0]) - 1;
+        while (DistanceBase[code] > distance) code--;
+        w.putCode(code, 5);
+        w.put(distance - DistanceBase[code], DistanceExtra[code]);
+      }
+
+      inline uint32_t hash(const uint8_t *p) {
+        uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+        return (v * 2654435761u) >> (32 - HashBits);
+      }
+
+      class BitReader {
+       public:
+        BitReader(const uint8_t *data, size_t len)
+            : _p(data), _end(data + len) {}
+        uint32_t get(int count) {
+          while (_count < count) {
+            if (_p == _end) {
+              _overrun = true;
+              return 0;
+            }
+            _acc |= (uint32_t)*_p++ << _count;
+            _count += 8;
+          }
+          uint32_t bits = _acc & ((1u << count) - 1);
+          _acc >>= count;
+          _count -= count;
+          return bits;
+        }
+        // drops the bits left in the current byte
+        void align() {
+          _acc = 0;
+          _count = 0;
+        }
+        // raw bytes, valid after align()
+        const uint8_t *take(size_t len) {
+          if ((size_t)(_end - _p) < len) {
+            _overrun = true;
+            return nullptr;
+          }
+          auto p = _p;
+          _p += len;
+          return p;
+        }
+        bool overrun() const {
+          return _overrun;
+        }
+        bool done() const {
+          return _p == _end;
+        }
+
+       private:
+        const uint8_t *_p, *_end;
+        uint32_t _acc = 0;
+        int _count = 0;
+        bool _overrun = false;
+      };
+
+      const int MaxBits = 15;
+
+      // canonical Huffman code, decoded bit by bit: slower than lookup
+      // tables, but small and fine for the sizes we deal with
+      struct Huffman {
+        uint16_t count[MaxBits + 1];
+        uint16_t symbol[288];
+        bool build(const uint8_t *lengths, int n) {
+          memset(count, 0, sizeof(count));
+          for (int i = 0; i < n; i++) count[lengths[i]]++;
+          int left = 1;
+          for (int len = 1; len <= MaxBits; len++) {
+            left = (left << 1) - count[len];
+            if (left < 0)
+              return false;  // over-subscribed
+          }
+          uint16_t offs[MaxBits + 1];
+          offs[1] = 0;
+          for (int len = 1; len < MaxBits; len++)
+            offs[len + 1] = offs[len] + count[len];
+          for (int i = 0; i < n; i++)
+            if (lengths[i])
+              symbol[offs[lengths[i]]++] = i;
+          return true;
+        }
+        int decode(BitReader &r) const {
+          int code = 0, first = 0, index = 0;
+          for (int len = 1; len <= MaxBits; len++) {
+            code |= r.get(1);
+            int n = count[len];
+            if (code - n < first)
+              return symbol[index + code - first];
+            index += n;
+            first = (first + n) << 1;
+            code <<= 1;
+          }
+          return -1;
+        }
+      };
+
+      bool inflateBlock(BitReader &r, const Huffman &lit, const Huffman &dist,
+                        std::string &out, size_t start, size_t limit) {
+        for (;;) {
+          int symbol = lit.decode(r);
+          if (symbol < 0 || r.overrun())
+            return false;
+          if (symbol < 256) {
+            if (out.size() - start >= limit)
+              return false;
+            out += (char)symbol;
+            continue;
+          }
+          if (symbol == 256)
+            return true;
+          symbol -= 257;
+          if (symbol >= 29)
+            return false;
+          int length = LengthBase[symbol] + r.get(LengthExtra[symbol]);
+          symbol = dist.decode(r);
+          if (symbol < 0 || symbol >= 30)
+            return false;
+          size_t distance = DistanceBase[symbol] + r.get(DistanceExtra[symbol]);
+          if (r.overrun() || distance > out.size() - start ||
+              out.size() - start + length > limit)
+            return false;
+          // may overlap, copy byte by byte
+          size_t from = out.size() - distance;
+          for (int i = 0; i < length; i++) out += out[from + i];
+        }
+      }
+
+    }  // namespace
+
+    void compress(const void *data, size_t len, std::string &out, bool final,
+                  int windowBits) {
+      auto src = (const uint8_t *)data;
+      const size_t window = 1 << windowBits;
+      BitWriter w(out);
+      w.put(final ? 1 : 0, 1);
+      w.put(1, 2);  // fixed Huffman codes
+      std::unique_ptr<int32_t[]> head(new int32_t[1 << HashBits]);
+      for (int i = 0; i < (1 << HashBits); i++) head[i] = -1;
+      size_t pos = 0;
+      while (pos < len) {
+        size_t length = 0;
+        size_t candidate = 0;
+        if (pos + MinMatch <= len) {
+          auto h = hash(src + pos);
+          auto prev = head[h];
+          head[h] = pos;
+          if (prev >= 0 && pos - prev <= window) {
+            candidate = prev;
+            size_t max = std::min(len - pos, (size_t)MaxMatch);
+            while (length < max && src[candidate + length] == src[pos + length])
+              length++;
+          }
+        }
+        if (length >= MinMatch) {
+          putMatch(w, length, pos - candidate);
+          // index the skipped positions too, cheap and helps the next match
+          auto end = pos + length;
+          for (pos++; pos < end; pos++)
+            if (pos + MinMatch <= len)
+              head[hash(src + pos)] = pos;
+        } else
+          putSymbol(w, src[pos++]);
+      }
+      putSymbol(w, 256);  // end of block
+      if (!final) {
+        // empty stored block
+        w.put(0, 3);
+        w.align();
+        out.append("\x00\x00\xff\xff", 4);
+      } else
+        w.align();
+    }
+
+    bool inflate(const void *data, size_t len, std::string &out,
+                 size_t limit) {
+      BitReader r((const uint8_t *)data, len);
+      size_t start = out.size();
+      std::unique_ptr<Huffman> lit(new Huffman), dist(new Huffman);
+      uint8_t lengths[288 + 32];
+      for (;;) {
+        if (r.done())
+          return true;  // ended with sync flush
+        bool last = r.get(1);
+        auto type = r.get(2);
+        if (r.overrun())
+          return false;
+        if (type == 0) {
+          r.align();
+          auto header = r.take(4);
+          if (!header || (header[0] ^ header[2]) != 0xff ||
+              (header[1] ^ header[3]) != 0xff)
+            return false;
+          size_t n = header[0] | (header[1] << 8);
+          auto bytes = r.take(n);
+          if (!bytes || out.size() - start + n > limit)
+            return false;
+          out.append((const char *)bytes, n);
+        } else if (type == 1) {
+          // fixed Huffman codes, RFC 1951 section 3.2.6
+          int i = 0;
+          for (; i < 144; i++) lengths[i] = 8;
+          for (; i < 256; i++) lengths[i] = 9;
+          for (; i < 280; i++) lengths[i] = 7;
+          for (; i < 288; i++) lengths[i] = 8;
+          lit->build(lengths, 288);
+          memset(lengths, 5, 30);
+          dist->build(lengths, 30);
+          if (!inflateBlock(r, *lit, *dist, out, start, limit))
+            return false;
+        } else if (type == 2) {
+          // dynamic Huffman codes, RFC 1951 section 3.2.7
+          static const uint8_t Order[19] = {16, 17, 18, 0, 8,  7, 9,
+                                            6,  10, 5,  11, 4, 12, 3,
+                                            13, 2,  14, 1,  15};
+          int nlen = r.get(5) + 257, ndist = r.get(5) + 1,
+              ncode = r.get(4) + 4;
+          if (nlen > 286 || ndist > 30)
+            return false;
+          memset(lengths, 0, 19);
+          for (int i = 0; i < ncode; i++) lengths[Order[i]] = r.get(3);
+          if (r.overrun() || !lit->build(lengths, 19))
+            return false;
+          for (int i = 0; i < nlen + ndist;) {
+            int symbol = lit->decode(r);
+            if (symbol < 0 || r.overrun())
+              return false;
+            if (symbol < 16) {
+              lengths[i++] = symbol;
+              continue;
+            }
+            int value = 0, repeat;
+            if (symbol == 16) {
+              if (!i)
+                return false;
+              value = lengths[i - 1];
+              repeat = 3 + r.get(2);
+            } else if (symbol == 17)
+              repeat = 3 + r.get(3);
+            else
+              repeat = 11 + r.get(7);
+            if (i + repeat > nlen + ndist)
+              return false;
+            while (repeat--) lengths[i++] = value;
+          }
+          if (!lengths[256] || !lit->build(lengths, nlen) ||
+              !dist->build(lengths + nlen, ndist))
+            return false;
+          if (!inflateBlock(r, *lit, *dist, out, start, limit))
+            return false;
+        } else
+          return false;
+        if (last)
+          return true;
+      }
+    }
+
+    void gzip(const void *data, size_t len, std::string &out) {
+      // magic, deflate, no flags, no mtime, no extra flags, unknown OS
+      out.append("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10);
+      compress(data, len, out, true);
+      uint32_t trailer[] = {crc32(0, data, len), (uint32_t)len};
+      // both are little endian, as is the target
+      out.append((const char *)trailer, sizeof(trailer));
+    }
+
+    uint32_t crc32(uint32_t crc, const void *data, size_t len) {
+      return esp_rom_crc32_le(crc, (const uint8_t *)data, len);
+    }
+
+  }  // namespace deflate
+}  // namespace esp32m
@@ -298,12 +298,12 @@ namespace esp32m {
           _pressure(this, "atmospheric_pressure"),
           _humidity(this, "humidity") {
       auto group = sensor::nextGroup();
-      _temperature.group = group;
+      _temperature.setGroup(group);
       _temperature.precision = 2;
-      _pressure.group = group;
+      _pressure.setGroup(group);
       _pressure.precision = 0;
       _pressure.unit = "mmHg";
-      _humidity.group = group;
+      _humidity.setGroup(group);
       _humidity.precision = 0;
       _humidity.disabled = chipId() != bme280::ChipId::Bme280;
       Device::init(Flags::HasSensors);
@@ -327,7 +327,7 @@ namespace esp32m {
       if (chipId() == bme280::ChipId::Bme280)
         _humidity.set(h, &changed);
       if (changed)
-        sensor::GroupChanged::publish(_temperature.group);
+        sensor::GroupChanged::publish(_temperature.group());
       return true;
     }
 
@@ -17,25 +17,25 @@ namespace esp32m {
           _frequency(this, "frequency") {
       Device::init(Flags::HasSensors);
       auto group = sensor::nextGroup();
-      _energyImp.group = group;
+      _energyImp.setGroup(group);
       _energyImp.precision = 2;
       _energyImp.name = "consumed energy";
       _energyImp.stateClass = sensor::StateClass::Total;
-      _energyExp.group = group;
+      _energyExp.setGroup(group);
       _energyExp.precision = 2;
       _energyExp.name = "supplied energy";
       _energyExp.stateClass = sensor::StateClass::Total;
-      _voltage.group = group;
+      _voltage.setGroup(group);
       _voltage.precision = 2;
-      _current.group = group;
+      _current.setGroup(group);
       _current.precision = 2;
-      _powerApparent.group = group;
+      _powerApparent.setGroup(group);
       _powerApparent.precision = 2;
-      _powerReactive.group = group;
+      _powerReactive.setGroup(group);
       _powerReactive.precision = 2;
-      _powerFactor.group = group;
+      _powerFactor.setGroup(group);
       _powerFactor.precision = 2;
-      _frequency.group = group;
+      _frequency.setGroup(group);
       _frequency.precision = 2;
     }
 
@@ -103,7 +103,7 @@ namespace esp32m {
       _powerFactor.set(_pf, &changed);
       _frequency.set(_f, &changed);
       if (changed)
-        sensor::GroupChanged::publish(_energyExp.group);
+        sensor::GroupChanged::publish(_energyExp.group());
 
       return true;
     }
@@ -6,115 +6,261 @@
 
 #include <esp_task_wdt.h>
 #include <math.h>
+#include <algorithm>
+#include <functional>
 
 namespace esp32m {
 
-  class EventPollSensors : public Event {
-   public:
-    EventPollSensors() : Event(Type) {}
-    static bool is(Event &ev) {
-      return ev.is(Type);
+  namespace sensor {
+
+    // shortest adaptive poll interval, in milliseconds
+    const int PollIntervalFloor = 100;
+
+    /**
+     * Single task that polls sensors of all devices. Poll deadlines are kept in
+     * a min-heap, so the next wakeup is always at the top of the heap. Entries
+     * are never removed from the middle: when a device is re-scheduled, the old
+     * entry becomes stale (its deadline no longer matches the one recorded in
+     * the device) and is dropped when it reaches the top.
+     * The config holds adaptive poll interval bounds per device name, both
+     * are required:
+     * @code
+     * {"dsts": {"min": 5000, "max": 120000}}
+     * @endcode
+     */
+    class Poller : public AppObject {
+     public:
+      Poller(const Poller &) = delete;
+      static Poller &instance() {
+        static Poller i;
+        return i;
+      }
+      const char *name() const override {
+        return "sensors-poll";
+      }
+      void add(Device *device);
+      void schedule(Device *device);
+
+     protected:
+      bool setConfig(const JsonVariantConst cfg,
+                     DynamicJsonDocument **result) override;
+      DynamicJsonDocument *getConfig(RequestContext &ctx) override;
+      void handleEvent(Event &ev) override;
+
+     private:
+      struct Deadline {
+        unsigned long at;
+        Device *device;
+        bool operator>(const Deadline &other) const {
+          return at > other.at;
+        }
+      };
+      std::mutex _mutex;
+      std::vector<Deadline> _heap;
+      std::vector<Device *> _devices;
+      std::unique_ptr<DynamicJsonDocument> _config;
+      TaskHandle_t _task = nullptr;
+      Poller();
+      void run();
+      void configure(Device *device);
+    };
+
+    Poller::Poller() {
+      xTaskCreate([](void *self) { ((Poller *)self)->run(); }, "m/sensors",
+                  4096, this, 1, &_task);
     }
 
-   private:
-    constexpr static const char *Type = "poll-sensors";
-  };
+    void Poller::handleEvent(Event &ev) {
+      if (EventInited::is(ev) && _task)
+        xTaskNotifyGive(_task);
+    }
 
-  class EventPollSensorsTime : public Event {
-   public:
-    EventPollSensorsTime() : Event(Type) {}
-    static bool is(Event &ev, EventPollSensorsTime **pste) {
-      bool result = ev.is(Type);
-      if (result && pste)
-        *pste = (EventPollSensorsTime *)&ev;
-      return result;
+    void Poller::add(Device *device) {
+      {
+        std::lock_guard guard(_mutex);
+        _devices.push_back(device);
+      }
+      // schedules the first poll
+      configure(device);
     }
-    void record(unsigned long next) {
-      if (next < _next)
-        _next = next;
+
+    void Poller::configure(Device *device) {
+      int min = 0, max = 0;
+      {
+        std::lock_guard guard(_mutex);
+        if (_config) {
+          auto cfg = _config->as<JsonObjectConst>()[device->name()];
+          json::from(cfg["min"], min);
+          json::from(cfg["max"], max);
+        }
+      }
+      device->setSensorsPollBounds(min, max);
     }
-    unsigned long getNext() {
-      return _next;
+
+    bool Poller::setConfig(const JsonVariantConst cfg,
+                           DynamicJsonDocument **result) {
+      std::vector<Device *> devices;
+      {
+        std::lock_guard guard(_mutex);
+        if (_config && json::checkEqual(_config->as<JsonVariantConst>(), cfg))
+          return false;
+        if (cfg.is<JsonObjectConst>()) {
+          auto doc = new DynamicJsonDocument(cfg.memoryUsage());
+          doc->set(cfg);
+          _config.reset(doc);
+        } else
+          _config.reset();
+        devices = _devices;
+      }
+      for (auto device : devices) configure(device);
+      return true;
     }
 
-   private:
-    unsigned long _next = ULONG_MAX;
-    constexpr static const char *Type = "poll-sensors-time";
-  };
+    DynamicJsonDocument *Poller::getConfig(RequestContext &ctx) {
+      std::lock_guard guard(_mutex);
+      if (!_config)
+        return nullptr;
+      auto doc = new DynamicJsonDocument(_config->memoryUsage());
+      doc->set(*_config);
+      return doc;
+    }
+
+    void Poller::schedule(Device *device) {
+      auto at = device->nextSensorsPollTime();
+      bool earliest;
+      {
+        std::lock_guard guard(_mutex);
+        device->_sensorsPollAt = at;
+        _heap.push_back({at, device});
+        std::push_heap(_heap.begin(), _heap.end(), std::greater<Deadline>());
+        earliest = _heap.front().device == device && _heap.front().at == at;
+      }
+      if (earliest && _task)
+        xTaskNotifyGive(_task);
+    }
+
+    void Poller::run() {
+      std::vector<Device *> due;
+      esp_task_wdt_add(NULL);
+      for (;;) {
+        int sleepTime = 1000;
+        esp_task_wdt_reset();
+        if (App::initialized()) {
+          auto current = millis();
+          {
+            std::lock_guard guard(_mutex);
+            while (!_heap.empty() && _heap.front().at <= current) {
+              auto top = _heap.front();
+              std::pop_heap(_heap.begin(), _heap.end(),
+                            std::greater<Deadline>());
+              _heap.pop_back();
+              if (top.device->_sensorsPollAt == top.at)
+                due.push_back(top.device);
+            }
+            if (!_heap.empty())
+              sleepTime = _heap.front().at - current;
+          }
+          if (due.size()) {
+            {
+              locks::Guard guard(net::ota::Name);
+              for (auto device : due) {
+                esp_task_wdt_reset();
+                if (device->shouldPollSensors())
+                  device->runSensorsPoll();
+              }
+            }
+            for (auto device : due) schedule(device);
+            due.clear();
+            // let lower priority tasks run even if the next poll is overdue
+            vTaskDelay(1);
+            continue;
+          }
+        }
+        int wdt = App::instance().wdtTimeout() * 1000 - 100;
+        if (sleepTime > wdt)
+          sleepTime = wdt;
+        if (sleepTime > 0)
+          ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleepTime));
+      }
+    }
+
+  }  // namespace sensor
 
   void Device::init(Flags flags) {
     _flags = flags;
-    if (flags & Flags::HasSensors)
-      setupSensorPollTask();
+    if (flags & Flags::HasSensors) {
+      // sensor settings must be in place before the config is loaded, even if
+      // the device creates its sensors later
+      sensor::Manager::instance();
+      sensor::Poller::instance().add(this);
+    }
+  }
+
+  void Device::setSensorsPollBounds(int minMs, int maxMs) {
+    if (minMs <= 0 || maxMs <= 0)
+      minMs = maxMs = 0;
+    else
+      minMs = std::max(minMs, sensor::PollIntervalFloor);
+    _sensorsPollMin = minMs;
+    _sensorsPollMax = maxMs;
+    _sensorsPollCurrent = clampSensorsPollInterval(_sensorsPollInterval);
+    if (hasSensors())
+      scheduleSensorsPoll();
+  }
+
+  void Device::adaptSensorsPollInterval(bool changed) {
+    // halve quickly to catch up with changes, back off gently when stable
+    int interval = changed ? _sensorsPollCurrent / 2
+                           : _sensorsPollCurrent + _sensorsPollCurrent / 4 + 1;
+    _sensorsPollCurrent = clampSensorsPollInterval(interval);
+  }
+
+  void Device::runSensorsPoll() {
+    _sensorsChanged = false;
+    if (sensorsReady() && !pollSensors())
+      resetSensors();
+    if (isSensorsPollAdaptive())
+      adaptSensorsPollInterval(_sensorsChanged);
+    _sensorsPolledAt = millis();
+    /*logI("sensors polled at %d, next poll at %d", _sensorsPolledAt,
+         nextSensorsPollTime());*/
+  }
+
+  void Device::scheduleSensorsPoll() {
+    sensor::Poller::instance().schedule(this);
   }
 
-  void Device::handleEvent(Event &ev) {
-    if ((_flags & Flags::HasSensors) == 0)
+  void Device::legacySensor(const char *sensor, float value) {
+    if (!isSensorsPollAdaptive()) {
+      if (!_legacyValues.empty())
+        _legacyValues.clear();
       return;
-    EventPollSensorsTime *pste;
-    if (EventPollSensorsTime::is(ev, &pste))
-      pste->record(nextSensorsPollTime());
-    else if (EventPollSensors::is(ev) && shouldPollSensors()) {
-      if (sensorsReady() && !pollSensors())
-        resetSensors();
-      _sensorsPolledAt = millis();
-      /*logI("sensors polled at %d, next poll at %d", _sensorsPolledAt,
-           nextSensorsPollTime());*/
     }
+    auto it = _legacyValues.find(sensor);
+    if (it == _legacyValues.end())
+      _legacyValues.emplace(sensor, value);
+    else if (it->second != value)
+      it->second = value;
+    else
+      return;
+    _sensorsChanged = true;
   }
 
   void Device::sensor(const char *sensor, const float value) {
-    if (!isnan(value))
-      EventSensor::publish(*this, sensor, value, json::null<JsonObjectConst>());
+    if (isnan(value))
+      return;
+    legacySensor(sensor, value);
+    EventSensor::publish(*this, sensor, value, json::null<JsonObjectConst>());
   };
 
   void Device::sensor(const char *sensor, const float value,
                       const JsonObjectConst props) {
-    if (!isnan(value))
-      EventSensor::publish(*this, sensor, value, props);
+    if (isnan(value))
+      return;
+    legacySensor(sensor, value);
+    EventSensor::publish(*this, sensor, value, props);
   };
 
-  void Device::setupSensorPollTask() {
-    static TaskHandle_t task = nullptr;
-    // static Sleeper sleeper;
-    static EventPollSensors ev;
-    if (task)
-      xTaskNotifyGive(task);
-    else
-      xTaskCreate(
-          [](void *) {
-            EventManager::instance().subscribe([](Event &ev) {
-              if (EventInited::is(ev) && task)
-                xTaskNotifyGive(task);
-            });
-            esp_task_wdt_add(NULL);
-            for (;;) {
-              int sleepTime = 0;
-              esp_task_wdt_reset();
-              if (App::initialized()) {
-                EventPollSensorsTime pste;
-                pste.publish();
-                auto next = pste.getNext();
-                auto current = millis();
-                if (next < current) {
-                  locks::Guard guard(net::ota::Name);
-                  ev.publish();
-                } else
-                  sleepTime = next - current;  // sleeper.sleep();
-                /*logi("next poll at %d, current time %d, sleep %d", next,
-                     current, sleepTime);*/
-              } else
-                sleepTime = 1000;
-              auto wdt = App::instance().wdtTimeout() - 100;
-              if (sleepTime > wdt)
-                sleepTime = wdt;
-              if (sleepTime > 0)
-                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleepTime));
-            }
-          },
-          "m/sensors", 4096, nullptr, 1, &task);
-  }
-
   bool Device::sensorsReady() {
     if (_sensorsReady)
       return true;
@@ -123,26 +269,120 @@ namespace esp32m {
       return false;
     _sensorsInitAt = ms;
     _sensorsReady = initSensors();
-    if (_sensorsReady)
+    if (_sensorsReady) {
       logI("device initialized");
+      // the name may be known only now, after the chip was detected
+      sensor::reindex(this);
+    }
     return _sensorsReady;
   }
 
   namespace sensor {
 
-    std::mutex _sensorsMutex;
-    std::map<std::string, Sensor *> _sensors;
+    // recursive, as uid() takes it too
+    std::recursive_mutex _sensorsMutex;
+    // sensors whose uid was never built, they are indexed on first lookup
+    int _unindexed = 0;
+    // indexed by sensor handle
+    std::vector<Sensor *> _sensors;
+    // ordered by uid, for lookups
+    std::vector<Sensor *> _sorted;
+    // members of each group, indexed by group id
+    std::vector<std::vector<Sensor *> > _groups;
     int _groupCounter = 0;
+    std::atomic<uint32_t> _version;
+    std::atomic<uint32_t> _generation;
+    std::mutex _valuesMutex;
 
-    Sensor *find(std::string uid) {
+    uint32_t version() {
+      return _version.load(std::memory_order_acquire);
+    }
+
+    void touch() {
+      _version.fetch_add(1, std::memory_order_release);
+    }
+
+    std::mutex &valuesMutex() {
+      return _valuesMutex;
+    }
+
+    /**
+     * Compares uid with the concatenation of the given parts without building
+     * the concatenated string
+     */
+    int compareUid(const std::string &uid, const char *device, const char *id) {
+      auto u = uid.c_str();
+      for (auto part : {device, "_", id})
+        for (; *part; part++, u++)
+          if (*u != *part)
+            return (unsigned char)*u - (unsigned char)*part;
+      return *u ? 1 : 0;
+    }
+
+    // must be called with the registry lock held
+    void indexAll() {
+      if (_unindexed)
+        for (auto sensor : _sensors) sensor->uid();
+    }
+
+    Sensor *find(const char *uid) {
+      if (!uid)
+        return nullptr;
       std::lock_guard lock(_sensorsMutex);
-      auto it = _sensors.find(uid);
-      return it == _sensors.end() ? nullptr : it->second;
+      indexAll();
+      auto it = std::lower_bound(_sorted.begin(), _sorted.end(), uid,
+                                 [](Sensor *s, const char *uid) {
+                                   return strcmp(s->_uid.c_str(), uid) < 0;
+                                 });
+      return it != _sorted.end() && (*it)->_uid == uid ? *it : nullptr;
+    }
+
+    Sensor *find(const std::string &uid) {
+      return find(uid.c_str());
     }
 
     Sensor *find(Device *device, const char *id) {
-      auto uid = string_printf("%s_%s", device->name(), id);
-      return find(uid);
+      auto name = device->name();
+      std::lock_guard lock(_sensorsMutex);
+      indexAll();
+      auto it = std::lower_bound(_sorted.begin(), _sorted.end(), id,
+                                 [name](Sensor *s, const char *id) {
+                                   return compareUid(s->_uid, name, id) < 0;
+                                 });
+      return it != _sorted.end() && !compareUid((*it)->_uid, name, id)
+                 ? *it
+                 : nullptr;
+    }
+
+    Sensor *byHandle(int handle) {
+      std::lock_guard lock(_sensorsMutex);
+      return handle >= 0 && handle < _sensors.size() ? _sensors[handle]
+                                                      : nullptr;
+    }
+
+    int count() {
+      std::lock_guard lock(_sensorsMutex);
+      return _sensors.size();
+    }
+
+    uint32_t generation() {
+      return _generation.load(std::memory_order_acquire);
+    }
+
+    void reindex(Device *device) {
+      std::vector<Sensor *> renamed;
+      {
+        std::lock_guard lock(_sensorsMutex);
+        for (auto sensor : _sensors)
+          if (sensor->device() == device) {
+            std::string prev = sensor->_uid;
+            sensor->reindex();
+            if (sensor->_uid != prev)
+              renamed.push_back(sensor);
+          }
+      }
+      // the config is keyed by uid
+      for (auto sensor : renamed) Manager::instance().configure(sensor);
     }
 
     int nextGroup() {
@@ -150,28 +390,96 @@ namespace esp32m {
       return ++_groupCounter;
     }
 
-    Group::Iterator::Iterator(int id) : _id(id) {
-      if (id < 0)
-        _inner = _sensors.end();
+    Sensor *Iterator::operator*() const {
+      std::lock_guard lock(_sensorsMutex);
+      if (_group <= 0)
+        return _index < _sensors.size() ? _sensors[_index] : nullptr;
+      if (_group >= _groups.size())
+        return nullptr;
+      auto &members = _groups[_group];
+      return _index < members.size() ? members[_index] : nullptr;
+    }
+
+    Group::Iterator Group::end() const {
+      std::lock_guard lock(_sensorsMutex);
+      return Iterator(_id, _id > 0 && _id < _groups.size()
+                               ? _groups[_id].size()
+                               : 0);
+    }
+
+    All::Iterator All::end() const {
+      std::lock_guard lock(_sensorsMutex);
+      return Iterator(0, _sensors.size());
+    }
+
+    // a reading costs 12 bytes on the 32-bit targets, down from the 40 bytes
+    // of the DynamicJsonDocument it replaced
+    static_assert(sizeof(void *) != 4 || sizeof(Value) == 12,
+                  "sensor value grew");
+
+    void Value::setString(const char *value) {
+      _type = Type::String;
+      if (!value)
+        value = "";
+      auto len = strlen(value);
+      _heap = len >= InlineChars;
+      if (_heap)
+        _u.p = strdup(value);
+      else
+        memcpy(_u.s, value, len + 1);
+    }
+
+    void Value::assign(const Value &other) {
+      if (other._type == Type::String)
+        setString(other.str());
       else {
-        _inner = _sensors.begin();
-        if (_inner->second->group != _id)
-          next();
+        _type = other._type;
+        _u = other._u;
       }
     }
-    void Group::Iterator::next() {
-      for (;;) {
-        _inner++;
-        if (_inner == _sensors.end() || _inner->second->group == _id)
-          break;
-      }
+
+    void Value::release() {
+      if (_heap)
+        free(_u.p);
+      _heap = false;
+      _type = Type::Null;
     }
 
-    All::Iterator All::begin() const {
-      return All::Iterator(_sensors.begin());
+    bool convertToJson(const Value &src, JsonVariant dst) {
+      switch (src.type()) {
+        case Value::Type::Float:
+          return dst.set(src.as<float>());
+        case Value::Type::Int:
+          return dst.set(src.as<int32_t>());
+        case Value::Type::Bool:
+          return dst.set(src.as<bool>());
+        case Value::Type::String:
+          // non-const pointer makes ArduinoJson copy the string
+          return dst.set((char *)src.as<const char *>());
+        default:
+          dst.clear();
+          return true;
+      }
     }
-    All::Iterator All::end() const {
-      return All::Iterator(_sensors.end());
+
+    bool DirtySet::set(int handle) {
+      if (handle < 0)
+        return false;
+      auto b = handle / (BlockWords * 32);
+      if (b >= MaxBlocks)
+        return false;
+      auto words = _blocks[b].load(std::memory_order_acquire);
+      if (!words) {
+        auto fresh = new std::atomic<uint32_t>[BlockWords]();
+        if (_blocks[b].compare_exchange_strong(words, fresh,
+                                               std::memory_order_acq_rel))
+          words = fresh;
+        else
+          delete[] fresh;  // another task won, words now points to its block
+      }
+      auto w = (handle / 32) % BlockWords;
+      uint32_t bit = 1u << (handle % 32);
+      return !(words[w].fetch_or(bit) & bit);
     }
 
     StateEmitter::StateEmitter(EmitFlags flags) : _flags(flags) {}
@@ -187,18 +495,13 @@ namespace esp32m {
                     4096, this, 1, &_task);
       else if (sensor::GroupChanged::is(ev, &gc)) {
         for (auto sensor : gc->group())
-          if (!sensor->disabled && filter(sensor)) {
-            std::lock_guard guard(_queueMutex);
-            _queue[sensor->uid()].sensor = sensor;
+          if (!sensor->disabled && filter(sensor) &&
+              _dirty.set(sensor->handle()))
             changed = true;
-          }
       } else if (sensor::Changed::is(ev, &sc)) {
         auto sensor = sc->sensor();
-        if (!sensor->disabled && filter(sensor)) {
-          std::lock_guard guard(_queueMutex);
-          _queue[sensor->uid()].sensor = sensor;
+        if (!sensor->disabled && filter(sensor) && _dirty.set(sensor->handle()))
           changed = true;
-        }
       }
       if (changed && _task && (_flags & EmitFlags::OnChange))
         xTaskNotifyGive(_task);
@@ -210,22 +513,19 @@ namespace esp32m {
       for (;;) {
         esp_task_wdt_reset();
         if ((_flags & EmitFlags::Periodically) && shouldEmit()) {
+          // everything is emitted anyway, changes made after this point will
+          // be picked up on the next round
+          _dirty.clear();
           sensor::All all;
           for (auto sensor : all)
-            if (!sensor->disabled && filter(sensor)) {
+            if (sensor && !sensor->disabled && filter(sensor))
               sensors.push_back(sensor);
-              std::lock_guard guard(_queueMutex);
-              auto queued = _queue.find(sensor->uid());
-              if (queued != _queue.end())
-                _queue.erase(queued);
-            }
-        } else {
-          std::lock_guard guard(_queueMutex);
-          if (_queue.size()) {
-            for (auto const &kv : _queue) sensors.push_back(kv.second.sensor);
-            _queue.clear();
-          }
-        }
+        } else
+          _dirty.drain([&sensors](int handle) {
+            auto sensor = byHandle(handle);
+            if (sensor)
+              sensors.push_back(sensor);
+          });
         if (sensors.size()) {
           emit(sensors);
           sensors.clear();
@@ -235,7 +535,7 @@ namespace esp32m {
         /*logD("current %d, next %d, sleepTime=%d ", current, nextTime(),
              sleepTime);*/
 
-        auto wdt = App::instance().wdtTimeout() - 100;
+        unsigned long wdt = App::instance().wdtTimeout() * 1000 - 100;
         if (sleepTime > wdt)
           sleepTime = wdt;
         if (sleepTime > 0)
@@ -243,14 +543,264 @@ namespace esp32m {
       }
     }
 
+    Manager &Manager::instance() {
+      static Manager i;
+      return i;
+    }
+
+    void Manager::configure(Sensor *sensor) {
+      Limits limits;
+      Pipeline *pipeline = nullptr;
+      {
+        std::lock_guard lock(_mutex);
+        if (_config) {
+          auto cfg =
+              _config->as<JsonObjectConst>()[sensor->uid().c_str()];
+          json::from(cfg["deadband"], limits.deadband);
+          json::from(cfg["deadband_rel"], limits.deadbandRel);
+          json::from(cfg["min_interval"], limits.minInterval);
+          json::from(cfg["heartbeat"], limits.heartbeat);
+          auto filters = cfg["filters"].as<JsonArrayConst>();
+          if (filters.size()) {
+            pipeline = Pipeline::create(filters);
+            if (pipeline->size() != filters.size())
+              logW("some filters of %s are not valid and were skipped",
+                   sensor->uid().c_str());
+          }
+        }
+      }
+      sensor->setLimits(limits);
+      sensor->setFilters(pipeline);
+    }
+
+    DynamicJsonDocument *Manager::snapshot(const JsonVariantConst args) {
+      int group = args["group"] | 0;
+      auto type = args["type"].as<const char *>();
+      auto device = args["device"].as<const char *>();
+      auto since = args["version"];
+      auto matches = [=](Sensor *sensor) {
+        return !sensor->disabled && (!type || sensor->is(type)) &&
+               (!device || !strcmp(sensor->device()->name(), device));
+      };
+      static const std::vector<Sensor *> none;
+      struct Item {
+        Sensor *sensor;
+        Value value;
+        unsigned long updatedAt;
+      };
+      std::vector<Item> items;
+      uint32_t taken;
+      {
+        // registrations wait until we are done
+        std::lock_guard lock(_sensorsMutex);
+        auto &sensors = group <= 0 ? _sensors
+                        : group < _groups.size() ? _groups[group]
+                                                 : none;
+        size_t count = 0;
+        for (auto sensor : sensors)
+          if (matches(sensor))
+            count++;
+        items.reserve(count);
+        // values are copied with setters held off, so the set is consistent
+        // and matches the version
+        std::lock_guard values(_valuesMutex);
+        taken = version();
+        if (since.is<uint32_t>() && since.as<uint32_t>() == taken) {
+          auto doc = new DynamicJsonDocument(JSON_OBJECT_SIZE(2));
+          auto root = doc->to<JsonObject>();
+          root["version"] = taken;
+          root["millis"] = millis();
+          return doc;
+        }
+        for (auto sensor : sensors)
+          if (matches(sensor))
+            items.push_back({sensor, sensor->get(), sensor->updatedAt()});
+      }
+      size_t size = JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(items.size());
+      for (auto &item : items) {
+        size += JSON_ARRAY_SIZE(2) + item.value.memoryUsage();
+        if (item.sensor->precision >= 0)
+          size += JSON_STRING_SIZE(16);
+      }
+      auto doc = new DynamicJsonDocument(size);
+      auto root = doc->to<JsonObject>();
+      root["version"] = taken;
+      root["millis"] = millis();
+      auto values = root.createNestedObject("sensors");
+      for (auto &item : items) {
+        auto sensor = item.sensor;
+        auto entry = values.createNestedArray(sensor->uid().c_str());
+        if (sensor->precision >= 0 && item.value.is<float>())
+          entry.add(serialized(
+              roundToString(item.value.as<float>(), sensor->precision)));
+        else
+          entry.add(item.value);
+        entry.add(item.updatedAt);
+      }
+      return doc;
+    }
+
+    bool Manager::handleRequest(Request &req) {
+      if (req.is("sensors-snapshot")) {
+        auto doc = snapshot(req.data());
+        json::check(this, doc, "snapshot()");
+        req.respond(name(), *doc, false);
+        delete doc;
+        return true;
+      }
+      return AppObject::handleRequest(req);
+    }
+
+    bool Manager::setConfig(const JsonVariantConst cfg,
+                            DynamicJsonDocument **result) {
+      {
+        std::lock_guard lock(_mutex);
+        if (_config && json::checkEqual(_config->as<JsonVariantConst>(), cfg))
+          return false;
+        if (cfg.is<JsonObjectConst>()) {
+          auto doc = new DynamicJsonDocument(cfg.memoryUsage());
+          doc->set(cfg);
+          _config.reset(doc);
+        } else
+          _config.reset();
+      }
+      All all;
+      for (auto sensor : all)
+        if (sensor)
+          configure(sensor);
+      return true;
+    }
+
+    DynamicJsonDocument *Manager::getConfig(RequestContext &ctx) {
+      std::lock_guard lock(_mutex);
+      if (!_config)
+        return nullptr;
+      auto doc = new DynamicJsonDocument(_config->memoryUsage());
+      doc->set(*_config);
+      return doc;
+    }
+
   }  // namespace sensor
 
-  Sensor::Sensor(Device *device, const char *type, const char *id, size_t size)
-      : _device(device), _type(type), _value(size) {
+  Sensor::Sensor(Device *device, const char *type, const char *id)
+      : _device(device), _type(type) {
+    // the uid is built later, the device may not know its name yet
+    _id = id ? id : type;
+    {
+      std::lock_guard lock(sensor::_sensorsMutex);
+      _handle = sensor::_sensors.size();
+      sensor::_sensors.push_back(this);
+      sensor::_unindexed++;
+      sensor::_generation++;
+    }
+    sensor::Manager::instance().configure(this);
+  }
+
+  const std::string &Sensor::uid() const {
     std::lock_guard lock(sensor::_sensorsMutex);
-    if (id)
-      _id = id;
-    sensor::_sensors[uid()] = this;
+    reindex();
+    return _uid;
+  }
+
+  void Sensor::reindex() const {
+    auto name = _device->name();
+    if (_indexed && !sensor::compareUid(_uid, name, _id.c_str()))
+      return;
+    auto &sorted = sensor::_sorted;
+    auto self = const_cast<Sensor *>(this);
+    if (_indexed)
+      sorted.erase(std::find(sorted.begin(), sorted.end(), self));
+    else
+      sensor::_unindexed--;
+    _uid = name;
+    _uid += "_";
+    _uid += _id;
+    sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), self,
+                                   [](Sensor *a, Sensor *b) {
+                                     return a->_uid < b->_uid;
+                                   }),
+                  self);
+    _indexed = true;
+    sensor::_generation++;
+  }
+
+  void Sensor::setGroup(int group) {
+    std::lock_guard lock(sensor::_sensorsMutex);
+    auto &groups = sensor::_groups;
+    if (_group > 0 && _group < groups.size()) {
+      auto &members = groups[_group];
+      members.erase(std::remove(members.begin(), members.end(), this),
+                    members.end());
+    }
+    _group = group;
+    if (group > 0) {
+      if (group >= groups.size())
+        groups.resize(group + 1);
+      groups[group].push_back(this);
+    }
+  }
+
+  void Sensor::setLimits(const sensor::Limits &limits) {
+    delete _nextLimits.exchange(new sensor::Limits(limits));
+  }
+
+  void Sensor::setFilters(sensor::Pipeline *pipeline) {
+    if (!pipeline && !_filtered)
+      return;
+    _filtered = pipeline != nullptr;
+    // an empty pipeline tells set() to drop the current one
+    if (!pipeline)
+      pipeline = new sensor::Pipeline();
+    delete _nextPipeline.exchange(pipeline);
+  }
+
+  bool Sensor::filter(float &value) {
+    if (_nextPipeline.load(std::memory_order_relaxed)) {
+      auto next = _nextPipeline.exchange(nullptr);
+      if (next && next->empty()) {
+        delete next;
+        next = nullptr;
+      }
+      _pipeline.reset(next);
+    }
+    return !_pipeline || _pipeline->process(value);
+  }
+
+  bool Sensor::shouldReport(bool changed) {
+    if (_nextLimits.load(std::memory_order_relaxed)) {
+      std::unique_ptr<sensor::Limits> next(_nextLimits.exchange(nullptr));
+      if (next) {
+        _limits = *next;
+        // start over, so the next reading is reported regardless of the
+        // deadband
+        _everReported = false;
+        _pending = true;
+      }
+    }
+    if (!_limits.enabled())
+      return changed;
+    auto now = millis();
+    if (changed)
+      _pending = true;
+    bool report = _pending;
+    if (report && _everReported && _value.is<float>()) {
+      auto band = std::max(_limits.deadband,
+                           fabsf(_reported) * _limits.deadbandRel);
+      if (fabsf(_value.as<float>() - _reported) < band)
+        report = false;
+    }
+    if (report && _everReported && _limits.minInterval &&
+        now - _reportedAt < _limits.minInterval)
+      report = false;
+    if (!report && !(_everReported && _limits.heartbeat &&
+                     now - _reportedAt >= _limits.heartbeat))
+      return false;
+    _everReported = true;
+    _reportedAt = now;
+    _pending = false;
+    if (_value.is<float>())
+      _reported = _value.as<float>();
+    return true;
   }
 
 }  // namespace esp32m
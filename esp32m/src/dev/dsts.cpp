@@ -328,7 +328,7 @@ namespace esp32m {
         id += probe.codestr();
         sensor = new Sensor(this, "temperature", id.c_str());
         sensor->precision = 2;
-        sensor->group = _sensorGroup;
+        sensor->setGroup(_sensorGroup);
         if (probe.name)
           sensor->name = probe.name;
       }
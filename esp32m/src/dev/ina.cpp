@@ -425,11 +425,11 @@ namespace esp32m {
           _power(this, "power") {
       Device::init(Flags::HasSensors);
       auto group = sensor::nextGroup();
-      _voltage.group = group;
+      _voltage.setGroup(group);
       _voltage.precision = 2;
-      _current.group = group;
+      _current.setGroup(group);
       _current.precision = 4;
-      _power.group = group;
+      _power.setGroup(group);
       _power.precision = 4;
       _power.unit = "W";
     }
@@ -469,7 +469,7 @@ namespace esp32m {
       _power.set(value, &changed);
       _stamp = millis();
       if (changed)
-        sensor::GroupChanged::publish(_voltage.group);
+        sensor::GroupChanged::publish(_voltage.group());
 
       return true;
     }
@@ -28,7 +28,9 @@ namespace esp32m {
         return false;
       int samples = 0;
       float average = 0;
-      for (int i = 0; i < _samples; i++) {
+      // the configured filters smooth the readings instead
+      int count = _temperature.filtered() ? 1 : _samples;
+      for (int i = 0; i < count; i++) {
         float value;
         uint32_t mv;
         if (_adc->read(value, &mv) == ESP_OK) {
@@ -0,0 +1,209 @@
+#include "esp32m/dev/virtual.hpp"
+
+#include <algorithm>
+
+namespace esp32m {
+  namespace dev {
+
+    Virtual::Virtual(const char *name) : _name(name) {
+      // our sensors are created from config, sensor settings must be loaded
+      // by then
+      sensor::Manager::instance();
+      Device::init(Flags::None);
+    }
+
+    void Virtual::handleEvent(Event &ev) {
+      sensor::Changed *sc;
+      sensor::GroupChanged *gc;
+      bool isChanged = sensor::Changed::is(ev, &sc);
+      if (!isChanged && !sensor::GroupChanged::is(ev, &gc))
+        return;
+      std::lock_guard guard(_mutex);
+      if (_entries.empty())
+        return;
+      std::vector<Entry *> pending;
+      if (isChanged)
+        changed(sc->sensor(), pending);
+      else
+        for (auto sensor : gc->group())
+          if (sensor)
+            changed(sensor, pending);
+      for (auto entry : pending) evaluate(entry);
+    }
+
+    void Virtual::changed(const Sensor *sensor,
+                          std::vector<Entry *> &pending) {
+      if (_unresolved && sensor::generation() != _resolvedGeneration)
+        resolve();
+      auto handle = sensor->handle();
+      if (handle >= _dependents.size())
+        return;
+      for (auto entry : _dependents[handle])
+        if (std::find(pending.begin(), pending.end(), entry) == pending.end())
+          pending.push_back(entry);
+    }
+
+    void Virtual::resolve() {
+      _resolvedGeneration = sensor::generation();
+      _unresolved = 0;
+      for (auto &kv : _entries) {
+        auto entry = kv.second.get();
+        if (!entry->enabled)
+          continue;
+        auto &names = entry->expr.inputs();
+        for (int i = 0; i < names.size(); i++) {
+          if (entry->inputs[i] >= 0)
+            continue;
+          auto input = sensor::find(names[i]);
+          if (!input) {
+            _unresolved++;
+            continue;
+          }
+          auto handle = input->handle();
+          entry->inputs[i] = handle;
+          if (handle >= _dependents.size())
+            _dependents.resize(handle + 1);
+          _dependents[handle].push_back(entry);
+        }
+      }
+    }
+
+    void Virtual::rebuild() {
+      _dependents.clear();
+      for (auto &kv : _entries) {
+        auto entry = kv.second.get();
+        entry->inputs.assign(entry->expr.inputs().size(), -1);
+      }
+      resolve();
+      if (_unresolved)
+        logW("%d inputs are not registered yet", _unresolved);
+    }
+
+    void Virtual::evaluate(Entry *entry) {
+      if (!entry->enabled || entry->evaluating)
+        return;
+      float values[sensor::Expression::MaxInputs];
+      for (int i = 0; i < entry->inputs.size(); i++) {
+        auto input = sensor::byHandle(entry->inputs[i]);
+        if (!input || !input->get().is<float>())
+          return;
+        values[i] = input->get().as<float>();
+      }
+      float result;
+      if (!entry->expr.evaluate(values, result))
+        return;
+      entry->evaluating = true;
+      entry->sensor->set(result);
+      entry->evaluating = false;
+    }
+
+    DynamicJsonDocument *Virtual::getState(const JsonVariantConst args) {
+      std::lock_guard guard(_mutex);
+      size_t size = JSON_OBJECT_SIZE(_entries.size());
+      for (auto &kv : _entries) {
+        auto sensor = kv.second->sensor.get();
+        size += sensor->get().memoryUsage();
+        if (sensor->precision >= 0)
+          size += JSON_STRING_SIZE(16);
+      }
+      auto doc = new DynamicJsonDocument(size);
+      auto root = doc->to<JsonObject>();
+      for (auto &kv : _entries)
+        if (kv.second->enabled)
+          kv.second->sensor->to(root);
+      return doc;
+    }
+
+    bool Virtual::setConfig(const JsonVariantConst cfg,
+                            DynamicJsonDocument **result) {
+      std::lock_guard guard(_mutex);
+      auto obj = cfg.as<JsonObjectConst>();
+      bool changed = false;
+      for (auto &kv : _entries) {
+        auto entry = kv.second.get();
+        if ((entry->enabled || !entry->source.empty()) &&
+            !obj.containsKey(kv.first)) {
+          entry->enabled = false;
+          entry->source.clear();
+          entry->sensor->disabled = true;
+          changed = true;
+        }
+      }
+      for (auto kv : obj) {
+        auto id = kv.key().c_str();
+        auto item = kv.value();
+        auto &entry = _entries[id];
+        if (!entry) {
+          entry.reset(new Entry());
+          json::from(item["type"], entry->type);
+          if (entry->type.empty())
+            entry->type = "virtual";
+          entry->sensor.reset(new Sensor(this, entry->type.c_str(), id));
+          changed = true;
+        }
+        auto sensor = entry->sensor.get();
+        json::from(item["unit"], entry->unit, &changed);
+        json::from(item["name"], entry->title, &changed);
+        json::from(item["precision"], sensor->precision, &changed);
+        sensor->unit = entry->unit.empty() ? nullptr : entry->unit.c_str();
+        sensor->name = entry->title.empty() ? nullptr : entry->title.c_str();
+        std::string source;
+        json::from(item["expr"], source);
+        if (!entry->expr.compiled() || source != entry->source) {
+          entry->source = source;
+          if (!entry->expr.compile(source.c_str()))
+            logW("%s: %s in '%s'", id, entry->expr.error(), source.c_str());
+          changed = true;
+        }
+        bool enabled = entry->expr.compiled();
+        if (enabled != entry->enabled) {
+          entry->enabled = enabled;
+          changed = true;
+        }
+        sensor->disabled = !enabled;
+      }
+      if (changed) {
+        rebuild();
+        for (auto &kv : _entries) evaluate(kv.second.get());
+      }
+      return changed;
+    }
+
+    DynamicJsonDocument *Virtual::getConfig(RequestContext &ctx) {
+      std::lock_guard guard(_mutex);
+      size_t size = JSON_OBJECT_SIZE(_entries.size());
+      for (auto &kv : _entries) {
+        auto entry = kv.second.get();
+        if (!entry->enabled && entry->source.empty())
+          continue;
+        size += JSON_OBJECT_SIZE(5) + JSON_STRING_SIZE(kv.first.size()) +
+                JSON_STRING_SIZE(entry->source.size()) +
+                JSON_STRING_SIZE(entry->type.size()) +
+                JSON_STRING_SIZE(entry->unit.size()) +
+                JSON_STRING_SIZE(entry->title.size());
+      }
+      auto doc = new DynamicJsonDocument(size);
+      auto root = doc->to<JsonObject>();
+      for (auto &kv : _entries) {
+        auto entry = kv.second.get();
+        // keep entries that failed to compile, so they can be fixed
+        if (!entry->enabled && entry->source.empty())
+          continue;
+        auto item = root.createNestedObject(kv.first);
+        json::to(item, "expr", entry->source);
+        json::to(item, "type", entry->type);
+        if (!entry->unit.empty())
+          json::to(item, "unit", entry->unit);
+        if (!entry->title.empty())
+          json::to(item, "name", entry->title);
+        if (entry->sensor->precision >= 0)
+          json::to(item, "precision", entry->sensor->precision);
+      }
+      return doc;
+    }
+
+    Virtual *useVirtual(const char *name) {
+      return new Virtual(name);
+    }
+  }  // namespace dev
+}  // namespace esp32m
@@ -8,7 +8,7 @@ namespace esp32m {
       const char *stateClasses[] = {"measurement", "total", "total_increasing"};
 
       DynamicJsonDocument *describeSensor(Sensor *sensor) {
-        auto uid = sensor->uid();
+        auto &uid = sensor->uid();
         auto id = sensor->id();
         auto name = sensor->name;
         auto precision = sensor->precision;
@@ -40,7 +40,7 @@ namespace esp32m {
           else if (sensor->is("frequency"))
             unit = "Hz";
         }
-        auto group = sensor->group;
+        auto group = sensor->group();
 
         DynamicJsonDocument *doc = new DynamicJsonDocument(
             JSON_OBJECT_SIZE(8 + (group > 0 ? 1 : 0) + (unit ? 1 : 0) +
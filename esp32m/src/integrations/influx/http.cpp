@@ -0,0 +1,249 @@
+#include <ArduinoJson.h>
+#include <ctype.h>
+#include <esp_task_wdt.h>
+
+#include "esp32m/deflate.hpp"
+#include "esp32m/integrations/influx/http.hpp"
+#include "esp32m/props.hpp"
+
+namespace esp32m {
+  namespace integrations {
+    namespace influx {
+
+      namespace {
+        const int MinBackoff = 1000;
+        const int MaxBackoff = 5 * 60 * 1000;
+        const int Timeout = 5000;
+
+        void appendEncoded(std::string &out, const std::string &s) {
+          static const char *hex = "0123456789ABCDEF";
+          for (unsigned char c : s)
+            if (isalnum(c) || strchr("-._~", c))
+              out += c;
+            else {
+              out += '%';
+              out += hex[c >> 4];
+              out += hex[c & 15];
+            }
+        }
+      }  // namespace
+
+      void Http::handleEvent(Event &ev) {
+        if (EventPropChanged::is(ev, nullptr) || config::Changed::is(ev))
+          // hostname, props or sensor names may have changed
+          _lines.invalidate();
+        sensor::StateEmitter::handleEvent(ev);
+      }
+
+      void Http::emit(const std::vector<const Sensor *> &sensors) {
+        std::string body;
+        esp_http_client_handle_t client;
+        uint32_t epoch;
+        {
+          std::lock_guard guard(_mutex);
+          if (_url.empty() || _bucket.empty())
+            return;
+          auto now = _timestamps ? epochMicros() : 0;
+          for (auto sensor : sensors) {
+            auto mark = _lines.size();
+            if (!_lines.append(sensor, now))
+              continue;
+            if (mark && _lines.size() > _batchSize)
+              enqueue(mark);
+          }
+          if (!_lines.empty())
+            enqueue(_lines.size());
+          if (_queue.empty() || (_retryAt && millis() < _retryAt))
+            return;
+          _retryAt = 0;
+          if (!_client && !connect()) {
+            failed();
+            return;
+          }
+          // one batch per round, the rest waits for the following rounds
+          body = std::move(_queue.front());
+          _queue.pop_front();
+          _queued -= body.size();
+          client = _client;
+          epoch = _epoch;
+        }
+        // the server may take a while to answer, the config and the state
+        // must stay available meanwhile
+        esp_task_wdt_reset();
+        auto status = post(client, body);
+        std::lock_guard guard(_mutex);
+        _status = status;
+        // the batch was meant for the previous endpoint
+        if (epoch != _epoch)
+          return;
+        if (status / 100 == 2) {
+          _backoff = 0;
+          _sent++;
+        } else if (status / 100 == 4 && status != 408 && status != 429) {
+          // the server will never accept this batch, retrying it would
+          // block the whole queue
+          logW("batch of %d bytes rejected with status %d", (int)body.size(),
+               status);
+          _backoff = 0;
+          _dropped++;
+        } else {
+          failed();
+          _queued += body.size();
+          _queue.push_front(std::move(body));
+          trim();
+        }
+      }
+
+      void Http::failed() {
+        _failed++;
+        _backoff = _backoff ? std::min(_backoff * 2, MaxBackoff) : MinBackoff;
+        _retryAt = millis() + _backoff;
+        logW("write failed (status %d), retrying in %dms", _status, _backoff);
+      }
+
+      void Http::enqueue(size_t size) {
+        std::string body;
+        _lines.consume(size, [this, size, &body](const char *data) {
+          if (_gzip)
+            deflate::gzip(data, size, body);
+          else
+            body.assign(data, size);
+        });
+        _queued += body.size();
+        _queue.push_back(std::move(body));
+        trim();
+      }
+
+      void Http::trim() {
+        while (_queue.size() > 1 && _queued > _queueSize) {
+          _queued -= _queue.front().size();
+          _queue.pop_front();
+          _dropped++;
+        }
+      }
+
+      bool Http::connect() {
+        if (_stale) {
+          esp_http_client_cleanup(_stale);
+          _stale = nullptr;
+        }
+        _endpoint = _url;
+        if (!_endpoint.empty() && _endpoint.back() == '/')
+          _endpoint.pop_back();
+        _endpoint += "/api/v2/write?org=";
+        appendEncoded(_endpoint, _org);
+        _endpoint += "&bucket=";
+        appendEncoded(_endpoint, _bucket);
+        _endpoint += _timestamps ? "&precision=ns" : "";
+        esp_http_client_config_t config = {};
+        config.url = _endpoint.c_str();
+        config.method = HTTP_METHOD_POST;
+        config.timeout_ms = Timeout;
+        config.keep_alive_enable = true;
+        config.skip_cert_common_name_check = true;
+        _client = esp_http_client_init(&config);
+        if (!_client) {
+          _status = -1;
+          return false;
+        }
+        esp_http_client_set_header(_client, "Content-Type",
+                                   "text/plain; charset=utf-8");
+        if (_gzip)
+          esp_http_client_set_header(_client, "Content-Encoding", "gzip");
+        if (!_token.empty()) {
+          std::string auth("Token ");
+          auth += _token;
+          esp_http_client_set_header(_client, "Authorization", auth.c_str());
+        }
+        return true;
+      }
+
+      int Http::post(esp_http_client_handle_t client,
+                     const std::string &body) {
+        esp_http_client_set_post_field(client, body.data(), body.size());
+        auto err = esp_http_client_perform(client);
+        if (err != ESP_OK) {
+          logD("POST %s: %s", _endpoint.c_str(), esp_err_to_name(err));
+          // start with a fresh connection next time
+          esp_http_client_close(client);
+          return -1;
+        }
+        return esp_http_client_get_status_code(client);
+      }
+
+      void Http::reset() {
+        // the emitter task may be posting with it, it is cleaned up there
+        // before the next client is made
+        if (_client) {
+          if (_stale)
+            esp_http_client_cleanup(_stale);
+          _stale = _client;
+          _client = nullptr;
+        }
+        _retryAt = 0;
+        _backoff = 0;
+        _epoch++;
+      }
+
+      DynamicJsonDocument *Http::getState(const JsonVariantConst args) {
+        std::lock_guard guard(_mutex);
+        auto doc = new DynamicJsonDocument(JSON_OBJECT_SIZE(7));
+        auto root = doc->to<JsonObject>();
+        root["queued"] = _queue.size();
+        root["bytes"] = _queued;
+        root["sent"] = _sent;
+        root["failed"] = _failed;
+        root["dropped"] = _dropped;
+        root["status"] = _status;
+        if (_retryAt) {
+          auto now = millis();
+          root["retry"] = _retryAt > now ? _retryAt - now : 0;
+        }
+        return doc;
+      }
+
+      bool Http::setConfig(const JsonVariantConst cfg,
+                           DynamicJsonDocument **result) {
+        std::lock_guard guard(_mutex);
+        bool changed = false;
+        bool endpointChanged = false;
+        json::from(cfg["url"], _url, &endpointChanged);
+        json::from(cfg["org"], _org, &endpointChanged);
+        json::from(cfg["bucket"], _bucket, &endpointChanged);
+        json::from(cfg["token"], _token, &endpointChanged);
+        json::from(cfg["gzip"], _gzip, &endpointChanged);
+        json::from(cfg["timestamps"], _timestamps, &endpointChanged);
+        json::from(cfg["batch"], _batchSize, &changed);
+        json::from(cfg["queue"], _queueSize, &changed);
+        if (endpointChanged) {
+          reset();
+          // queued batches may be encoded differently or meant for another
+          // server
+          _queue.clear();
+          _queued = 0;
+          changed = true;
+        }
+        return changed;
+      }
+
+      DynamicJsonDocument *Http::getConfig(RequestContext &ctx) {
+        std::lock_guard guard(_mutex);
+        auto doc = new DynamicJsonDocument(
+            JSON_OBJECT_SIZE(8) + JSON_STRING_SIZE(_url.size()) +
+            JSON_STRING_SIZE(_org.size()) + JSON_STRING_SIZE(_bucket.size()) +
+            JSON_STRING_SIZE(_token.size()));
+        auto root = doc->to<JsonObject>();
+        json::to(root, "url", _url);
+        json::to(root, "org", _org);
+        json::to(root, "bucket", _bucket);
+        json::to(root, "token", _token);
+        json::to(root, "gzip", _gzip);
+        json::to(root, "timestamps", _timestamps);
+        json::to(root, "batch", _batchSize);
+        json::to(root, "queue", _queueSize);
+        return doc;
+      }
+
+    }  // namespace influx
+  }    // namespace integrations
+}  // namespace esp32m
@@ -0,0 +1,108 @@
+#include <math.h>
+#include <sys/time.h>
+
+#include "esp32m/integrations/influx/lines.hpp"
+
+namespace esp32m {
+  namespace integrations {
+    namespace influx {
+
+      namespace {
+        // anything before 2020 means the clock has not been synced yet
+        const time_t MinValidTime = 1577836800;
+
+        const char *MeasurementSpecial = ", ";
+        const char *KeySpecial = ",= ";
+
+        void appendEscaped(std::string &out, const char *s,
+                           const char *special) {
+          if (!s)
+            return;
+          for (; *s; s++) {
+            if (strchr(special, *s))
+              out += '\\';
+            out += *s;
+          }
+        }
+
+        void appendProps(std::string &out, JsonObjectConst props) {
+          std::string value;
+          for (JsonPairConst kv : props) {
+            value.clear();
+            if (kv.value().is<const char *>())
+              value = kv.value().as<const char *>();
+            else
+              serializeJson(kv.value(), value);
+            // empty tag values are not allowed
+            if (value.empty())
+              continue;
+            out += ',';
+            appendEscaped(out, kv.key().c_str(), KeySpecial);
+            out += '=';
+            appendEscaped(out, value.c_str(), KeySpecial);
+          }
+        }
+      }  // namespace
+
+      int64_t epochMicros() {
+        struct timeval tv;
+        if (gettimeofday(&tv, nullptr) || tv.tv_sec < MinValidTime)
+          return 0;
+        return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+      }
+
+      const std::string &LineWriter::tags(const Sensor *sensor) {
+        if (_stale.exchange(false))
+          _tags.clear();
+        auto handle = sensor->handle();
+        if (handle >= _tags.size())
+          _tags.resize(handle + 1);
+        auto &tags = _tags[handle];
+        if (!tags.empty())
+          return tags;
+        auto device = sensor->device();
+        appendEscaped(tags, "esp32m", MeasurementSpecial);
+        tags += ",unit=";
+        appendEscaped(tags, App::instance().hostname(), KeySpecial);
+        tags += ",device=";
+        appendEscaped(tags, device->name(), KeySpecial);
+        appendProps(tags, device->props());
+        appendProps(tags, sensor->props());
+        tags += ' ';
+        appendEscaped(tags, sensor->name ? sensor->name : sensor->id(),
+                      KeySpecial);
+        tags += '=';
+        tags.shrink_to_fit();
+        return tags;
+      }
+
+      bool LineWriter::append(const Sensor *sensor, int64_t now) {
+        auto &value = sensor->get();
+        if (!value.is<float>())
+          return false;
+        auto v = value.as<float>();
+        if (!isfinite(v))
+          return false;
+        char buf[48];
+        int l;
+        if (sensor->precision >= 0)
+          l = snprintf(buf, sizeof(buf), "%.*f", sensor->precision, v);
+        else
+          l = snprintf(buf, sizeof(buf), "%.7g", v);
+        if (l <= 0 || l >= sizeof(buf))
+          return false;
+        _buf += tags(sensor);
+        _buf.append(buf, l);
+        if (now) {
+          int64_t age = (int64_t)(millis() - sensor->updatedAt()) * 1000;
+          l = snprintf(buf, sizeof(buf), " %lld",
+                       (long long)(now - age) * 1000 /* ns */);
+          _buf.append(buf, l);
+        }
+        _buf += '\n';
+        return true;
+      }
+
+    }  // namespace influx
+  }    // namespace integrations
+}  // namespace esp32m
@@ -2,97 +2,63 @@
 
 #include "esp32m/integrations/influx/mqtt.hpp"
 #include "esp32m/net/mqtt.hpp"
+#include "esp32m/props.hpp"
 
 namespace esp32m {
   namespace integrations {
     namespace influx {
 
-      size_t serializeProps(const JsonObjectConst props, char **buf) {
-        if (props) {
-          auto size = measureJson(props);
-          char *bptr = *buf = (char *)malloc(size);
-
-          for (JsonPairConst kv : props) {
-            if (!size)
-              break;
-            if (bptr != *buf) {
-              *(++bptr) = ',';
-              size--;
-            }
-            auto l = snprintf(bptr, size, "%s=", kv.key().c_str());
-            bptr += l;
-            size -= l;
-            if (!size)
-              break;
-            if (kv.value().is<const char *>())
-              l = strlcpy(bptr, kv.value().as<const char *>(), size);
-            else
-              l = serializeJson(kv.value(), bptr, size);
-            bptr += l;
-            size -= l;
-          }
-          return bptr - *buf;
-        }
-
-        return 0;
-      }
-
       void Mqtt::handleEvent(Event &ev) {
         if (EventInit::is(ev, 0)) {
           auto name = App::instance().hostname();
           if (asprintf(&_sensorsTopic, "esp32m/sensor/%s", name) < 0)
             _sensorsTopic = nullptr;
-        }
+        } else if (EventPropChanged::is(ev, nullptr) || config::Changed::is(ev))
+          // hostname, props or sensor names may have changed
+          _lines.invalidate();
         sensor::StateEmitter::handleEvent(ev);
       }
 
-      void Mqtt::emit(std::vector<const Sensor *> sensors) {
+      void Mqtt::emit(const std::vector<const Sensor *> &sensors) {
+        auto &mqtt = net::Mqtt::instance();
+        if (!mqtt.isEnabled())
+          return;
+        // lines that go to the backlog must keep the time they were taken
+        auto now = _timestamps || mqtt.isBacklogged() ? epochMicros() : 0;
         for (auto sensor : sensors) {
-          auto value = sensor->get();
-          if (!value.is<float>())
+          auto mark = _lines.size();
+          if (!_lines.append(sensor, now))
             continue;
-          char *devProps, *props;
-          auto unitName = App::instance().hostname();
-          auto device = sensor->device();
-          auto devName = device->name();
-          auto dpl = serializeProps(device->props(), &devProps);
-          auto pl = serializeProps(sensor->props(), &props);
-          auto name = sensor->name ? sensor->name : sensor->id();
-          auto unl = strlen(unitName);
-          auto dnl = strlen(devName);
-          auto dl = 12 /* "esp32m,unit=" */ + unl + 8 /* ",device=" */ + dnl +
-                    (dpl ? (1 /* comma */ + dpl) : 0) +
-                    (pl ? (1 /* comma */ + pl) : 0) + 1 /*space*/ +
-                    strlen(name) + 1 /*=*/ + (16 + 1 /*value*/) + 1 /*null*/;
-          char *s = (char *)malloc(dl);
-          char *sp = s;
-          auto l =
-              snprintf(sp, dl, "esp32m,unit=%s,device=%s", unitName, devName);
-          sp += l;
-          dl -= l;
-          if (dpl && dl) {
-            l = snprintf(sp, dl, ",%s", devProps);
-            sp += l;
-            dl -= l;
-          }
-          if (pl && dl) {
-            l = snprintf(sp, dl, ",%s", props);
-            sp += l;
-            dl -= l;
-          }
-          if (dl) {
-            l = snprintf(sp, dl, " %s=%.16g", name, value.as<float>());
-            sp += l;
-            dl -= l;
-          }
-          if (dpl)
-            free(devProps);
-          if (pl)
-            free(props);
-          net::Mqtt::instance().publish(_sensorsTopic, s);
-          free(s);
+          // send what we have so far if this line does not fit
+          if (mark && _lines.size() > _batchSize)
+            flush(mark);
         }
+        if (!_lines.empty())
+          flush(_lines.size());
       }
+
+      void Mqtt::flush(size_t size) {
+        _lines.consume(size, [this](const char *data) {
+          net::Mqtt::instance().deliver(_sensorsTopic, data);
+        });
+      }
+
+      bool Mqtt::setConfig(const JsonVariantConst cfg,
+                           DynamicJsonDocument **result) {
+        bool changed = false;
+        json::from(cfg["batch"], _batchSize, &changed);
+        json::from(cfg["timestamps"], _timestamps, &changed);
+        return changed;
+      }
+
+      DynamicJsonDocument *Mqtt::getConfig(RequestContext &ctx) {
+        auto doc = new DynamicJsonDocument(JSON_OBJECT_SIZE(2));
+        auto root = doc->to<JsonObject>();
+        json::to(root, "batch", _batchSize);
+        json::to(root, "timestamps", _timestamps);
+        return doc;
+      }
+
     }  // namespace influx
   }    // namespace integrations
 }  // namespace esp32m
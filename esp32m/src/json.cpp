@@ -110,6 +110,48 @@ namespace esp32m {
       return result;
     }
 
+    bool diff(const JsonVariantConst from, const JsonVariantConst to,
+              JsonVariant patch) {
+      auto f = from.as<JsonObjectConst>();
+      auto t = to.as<JsonObjectConst>();
+      if (f.isNull() || t.isNull()) {
+        if (from == to)
+          return false;
+        patch.set(to);
+        return true;
+      }
+      bool changed = false;
+      JsonObject p;
+      auto member = [&](JsonString key) {
+        if (!changed) {
+          p = patch.to<JsonObject>();
+          changed = true;
+        }
+        return p[key];
+      };
+      for (JsonPairConst kv : t) {
+        auto key = kv.key();
+        if (!f.containsKey(key)) {
+          member(key).set(kv.value());
+          continue;
+        }
+        auto prev = f[key];
+        auto next = kv.value();
+        if (prev.is<JsonObjectConst>() && next.is<JsonObjectConst>()) {
+          // nested patch goes to a temporary document, to create the member
+          // only if something changed
+          DynamicJsonDocument nested(measure(prev) + measure(next));
+          if (diff(prev, next, nested.to<JsonVariant>()))
+            member(key).set(nested);
+        } else if (prev != next)
+          member(key).set(next);
+      }
+      for (JsonPairConst kv : f)
+        if (!t.containsKey(kv.key()))
+          member(kv.key()).set(nullptr);
+      return changed;
+    }
+
     size_t measure(const JsonVariantConst v) {
       size_t result = 0;
       if (v.is<JsonArray>() || v.is<JsonArrayConst>()) {
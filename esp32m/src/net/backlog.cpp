@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp32m/net/backlog.hpp"
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      namespace {
+        struct Header {
+          uint16_t topicLen;
+          uint8_t qos;
+          uint8_t retain;
+          uint32_t payloadLen;
+        };
+        // anything larger is a sign of corruption
+        const uint32_t MaxPayload = 65536;
+      }  // namespace
+
+      void Backlog::setLimits(size_t ram, size_t spill) {
+        std::lock_guard guard(_mutex);
+        _ramLimit = ram;
+        auto wasEnabled = _spillLimit > 0;
+        _spillLimit = spill;
+        if (!spill) {
+          if (_spilled) {
+            _dropped += _spilled;
+            _count -= _spilled;
+          }
+          unlinkSpill();
+          return;
+        }
+        if (wasEnabled || _spilled)
+          return;
+        // pick up messages stored before reboot
+        struct stat st;
+        if (stat(_path, &st) != 0)
+          return;
+        _writePos = st.st_size;
+        Record record;
+        while (_readPos < _writePos && read(record)) {
+          _readPos += _peeked;
+          _spilled++;
+        }
+        // the last write may have been interrupted
+        if (_readPos < _writePos) {
+          if (_spilled && truncate(_path, _readPos) == 0)
+            _writePos = _readPos;
+          else
+            _spilled = 0;
+        }
+        _peeked = 0;
+        _readPos = 0;
+        _count += _spilled;
+        if (_spilled)
+          logI("%d messages recovered", _spilled);
+        else
+          unlinkSpill();
+      }
+
+      void Backlog::add(const char *topic, const char *payload, int qos,
+                        bool retain) {
+        if (!topic || !payload)
+          return;
+        std::lock_guard guard(_mutex);
+        if (!_ramLimit && !_spillLimit) {
+          _dropped++;
+          return;
+        }
+        auto &record = _ram.emplace_back();
+        record.topic = topic;
+        record.payload = payload;
+        record.qos = qos;
+        record.retain = retain;
+        _ramSize += record.size();
+        _count++;
+        if (_ramSize > _ramLimit)
+          spill();
+      }
+
+      FILE *Backlog::file() {
+        // reads seek to the record, writes always go to the end
+        if (!_file)
+          _file = fopen(_path, "a+");
+        return _file;
+      }
+
+      void Backlog::spill() {
+        bool written = false;
+        while (_ramSize > _ramLimit && _ram.size() > 1) {
+          auto &record = _ram.front();
+          auto size = sizeof(Header) + record.topic.size() +
+                      record.payload.size();
+          bool spilled = false;
+          if (_spillLimit && _writePos + size <= _spillLimit) {
+            auto f = file();
+            // switching from reading to writing needs a seek
+            spilled = f && (written || fseek(f, 0, SEEK_END) == 0) &&
+                      write(f, record);
+            written = true;
+          }
+          if (spilled) {
+            _spilled++;
+            _writePos += size;
+          } else {
+            _dropped++;
+            _count--;
+          }
+          _ramSize -= record.size();
+          _ram.pop_front();
+        }
+        if (!written)
+          return;
+        // the spilled messages must survive a reboot
+        if (_spilled && _file)
+          fflush(_file);
+        else
+          unlinkSpill();
+      }
+
+      bool Backlog::write(FILE *file, const Record &record) {
+        Header h = {.topicLen = (uint16_t)record.topic.size(),
+                    .qos = (uint8_t)record.qos,
+                    .retain = record.retain,
+                    .payloadLen = (uint32_t)record.payload.size()};
+        return fwrite(&h, sizeof(h), 1, file) == 1 &&
+               fwrite(record.topic.data(), 1, h.topicLen, file) ==
+                   h.topicLen &&
+               fwrite(record.payload.data(), 1, h.payloadLen, file) ==
+                   h.payloadLen;
+      }
+
+      bool Backlog::read(Record &record) {
+        auto file = this->file();
+        if (!file)
+          return false;
+        Header h;
+        bool result = fseek(file, _readPos, SEEK_SET) == 0 &&
+                      fread(&h, sizeof(h), 1, file) == 1 && h.topicLen &&
+                      h.payloadLen <= MaxPayload;
+        if (result) {
+          record.topic.resize(h.topicLen);
+          record.payload.resize(h.payloadLen);
+          record.qos = h.qos;
+          record.retain = h.retain;
+          result = fread(record.topic.data(), 1, h.topicLen, file) ==
+                       h.topicLen &&
+                   fread(record.payload.data(), 1, h.payloadLen, file) ==
+                       h.payloadLen;
+          _peeked = sizeof(h) + h.topicLen + h.payloadLen;
+        }
+        return result;
+      }
+
+      bool Backlog::peek(Record &record) {
+        std::lock_guard guard(_mutex);
+        if (_spilled) {
+          if (read(record))
+            return true;
+          logW("spill file is corrupt, %d messages lost", _spilled);
+          _dropped += _spilled;
+          _count -= _spilled;
+          unlinkSpill();
+        }
+        if (_ram.empty())
+          return false;
+        record = _ram.front();
+        return true;
+      }
+
+      void Backlog::pop() {
+        std::lock_guard guard(_mutex);
+        if (_spilled) {
+          if (!_peeked) {
+            Record record;
+            if (!read(record))
+              return;
+          }
+          _readPos += _peeked;
+          _peeked = 0;
+          _spilled--;
+          _count--;
+          if (!_spilled)
+            unlinkSpill();
+        } else if (!_ram.empty()) {
+          _ramSize -= _ram.front().size();
+          _ram.pop_front();
+          _count--;
+        }
+      }
+
+      void Backlog::clear() {
+        std::lock_guard guard(_mutex);
+        _ram.clear();
+        _ramSize = 0;
+        _count = 0;
+        unlinkSpill();
+      }
+
+      void Backlog::unlinkSpill() {
+        _spilled = _readPos = _writePos = _peeked = 0;
+        if (_file) {
+          fclose(_file);
+          _file = nullptr;
+        }
+        struct stat st;
+        if (stat(_path, &st) == 0)
+          unlink(_path);
+      }
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
@@ -0,0 +1,139 @@
+#include "esp32m/net/metrics.hpp"
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      void Metrics::sent(int id, int qos, size_t bytes) {
+        std::lock_guard guard(_mutex);
+        _tx += bytes;
+        if (qos <= 0 || id <= 0)
+          return;
+        auto &p = _pending[_next];
+        p.id = id;
+        p.at = millis();
+        _next = (_next + 1) % MaxPending;
+      }
+
+      void Metrics::acked(int id) {
+        std::lock_guard guard(_mutex);
+        for (auto &p : _pending)
+          if (p.id == id) {
+            uint32_t ms = millis() - p.at;
+            p.id = -1;
+            int b = 0;
+            while (b < Buckets - 1 && ms > Bounds[b]) b++;
+            _histogram[b]++;
+            if (ms > _latencyMax)
+              _latencyMax = ms;
+            _latencySum += ms;
+            _latencyCount++;
+            return;
+          }
+      }
+
+      void Metrics::received(size_t bytes) {
+        std::lock_guard guard(_mutex);
+        _rx += bytes;
+      }
+
+      void Metrics::handled(int64_t us) {
+        std::lock_guard guard(_mutex);
+        _handlerUs += us;
+        if (us > _handlerMaxUs)
+          _handlerMaxUs = us;
+        _handled++;
+      }
+
+      void Metrics::disconnected() {
+        std::lock_guard guard(_mutex);
+        if (!_downSince)
+          _downSince = millis();
+        // acknowledgements will not arrive for these
+        for (auto &p : _pending) p.id = -1;
+      }
+
+      void Metrics::ready() {
+        std::lock_guard guard(_mutex);
+        if (_connects++)
+          _reconnects++;
+        if (_downSince) {
+          _lastDowntime = millis() - _downSince;
+          _downtime += _lastDowntime;
+          _downSince = 0;
+        }
+      }
+
+      void Metrics::tick() {
+        std::lock_guard guard(_mutex);
+        auto now = millis();
+        auto elapsed = now - _tickAt;
+        if (elapsed < 1000)
+          return;
+        if (_tickAt) {
+          _txRate = (float)(_tx - _txMark) * 1000 / elapsed;
+          _rxRate = (float)(_rx - _rxMark) * 1000 / elapsed;
+        }
+        _txMark = _tx;
+        _rxMark = _rx;
+        _tickAt = now;
+        // average over the acknowledgements since the last tick
+        if (_latencyCount) {
+          _latencyAvg = (float)_latencySum / _latencyCount;
+          _latencySum = _latencyCount = 0;
+        }
+      }
+
+      void Metrics::toJson(JsonObject target) {
+        std::lock_guard guard(_mutex);
+        auto histogram = target.createNestedArray("latency");
+        for (auto count : _histogram) histogram.add(count);
+        target["latency_avg"] = _latencyAvg;
+        target["latency_max"] = _latencyMax;
+        target["tx"] = _tx;
+        target["rx"] = _rx;
+        target["tx_rate"] = _txRate;
+        target["rx_rate"] = _rxRate;
+        target["handled"] = _handled;
+        target["handler_us"] = _handlerUs;
+        target["handler_max_us"] = _handlerMaxUs;
+        target["reconnects"] = _reconnects;
+        target["downtime_last"] = _lastDowntime;
+        target["downtime"] =
+            _downtime + (_downSince ? millis() - _downSince : 0);
+      }
+
+      MetricsDevice::MetricsDevice(Metrics &metrics, Outbox &outbox)
+          : _metrics(metrics),
+            _outbox(outbox),
+            _latency(this, "duration", "latency"),
+            _tx(this, "data_rate", "tx"),
+            _rx(this, "data_rate", "rx"),
+            _depth(this, "queue", "outbox"),
+            _reconnects(this, "count", "reconnects") {
+        _latency.unit = "ms";
+        _latency.precision = 0;
+        _tx.unit = _rx.unit = "B/s";
+        _tx.precision = _rx.precision = 0;
+        _reconnects.stateClass = sensor::StateClass::TotalIncreasing;
+        Device::init(Flags::HasSensors);
+      }
+
+      void MetricsDevice::enable(bool enabled) {
+        for (auto sensor : {&_latency, &_tx, &_rx, &_depth, &_reconnects})
+          sensor->disabled = !enabled;
+      }
+
+      bool MetricsDevice::pollSensors() {
+        _metrics.tick();
+        _latency.set(_metrics.latency());
+        _tx.set(_metrics.txRate());
+        _rx.set(_metrics.rxRate());
+        _depth.set((int)_outbox.count());
+        _reconnects.set((int)_metrics.reconnects());
+        return true;
+      }
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
@@ -1,4 +1,6 @@
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <sys/time.h>
 
 #include "esp32m/app.hpp"
 #include "esp32m/base.hpp"
@@ -11,6 +13,10 @@
 #include "esp32m/net/mqtt.hpp"
 #include "esp32m/net/net.hpp"
 
+#ifndef CONFIG_ESP32M_NET_MQTT_URI
+#  define CONFIG_ESP32M_NET_MQTT_URI "mqtt://mqtt.lan"
+#endif
+
 namespace esp32m {
   namespace net {
 
@@ -18,13 +24,33 @@ namespace esp32m {
 
       int subscriptionIdCounter = 0;
 
+      // anything before 2020 means the clock has not been synced yet
+      const time_t MinValidTime = 1577836800;
+
+      /**
+       * Adds "ts" with the current time in milliseconds since the epoch to
+       * the serialized JSON object, so that messages sent from the backlog
+       * can be told apart and placed in time
+       */
+      static void stamp(std::string &payload) {
+        struct timeval tv;
+        if (payload.size() < 2 || payload[0] != '{' ||
+            gettimeofday(&tv, nullptr) || tv.tv_sec < MinValidTime)
+          return;
+        char buf[32];
+        snprintf(buf, sizeof(buf), "\"ts\":%lld%s",
+                 (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000,
+                 payload[1] == '}' ? "" : ",");
+        payload.insert(1, buf);
+      }
+
       Subscription::~Subscription() {
         _mqtt->unsubscribe(this);
       }
 
-      void StatePublisher::emit(std::vector<const Sensor *> sensors) {
+      void StatePublisher::emit(const std::vector<const Sensor *> &sensors) {
         auto &mqtt = Mqtt::instance();
-        if (mqtt.isReady()) {
+        if (mqtt.isEnabled()) {
           for (auto sensor : sensors) {
             size_t docsize = JSON_OBJECT_SIZE(1) + sensor->get().memoryUsage();
             if (sensor->precision >= 0)
@@ -32,20 +58,25 @@ namespace esp32m {
             auto doc = new DynamicJsonDocument(docsize);
             auto root = doc->to<JsonObject>();
             sensor->to(root);
-            publish(sensor->device()->name(), root);
+            // several sensors may share the device topic, so no coalescing
+            publish(sensor->device()->name(), root, Lane::Telemetry);
             delete doc;
           }
         }
       }
 
       esp_err_t StatePublisher::publish(const char *name,
-                                        JsonVariantConst state) {
+                                        JsonVariantConst state, Lane lane) {
         auto &mqtt = Mqtt::instance();
-        if (mqtt.isReady()) {
+        if (mqtt.isEnabled()) {
           auto topic = string_printf("esp32m/%s/%s/state",
                                      App::instance().hostname(), name);
           auto payload = json::serialize(state);
-          return mqtt.publish(topic.c_str(), payload.c_str());
+          if (mqtt.isBacklogged())
+            stamp(payload);
+          return mqtt.deliver(topic.c_str(), payload.c_str(), 0, false, lane)
+                     ? ESP_OK
+                     : ESP_FAIL;
         }
         return ESP_OK;
       }
@@ -56,7 +87,7 @@ namespace esp32m {
           auto state = stc->state();
           auto obj = stc->object();
           if (!state.isUnbound() && obj)
-            publish(obj->name(), state);
+            publish(obj->name(), state, Lane::State);
         }
         sensor::StateEmitter::handleEvent(ev);
       }
@@ -64,10 +95,17 @@ namespace esp32m {
 
     using namespace mqtt;
 
-    Mqtt::Mqtt() : _certCache("/mqtt-cert", http::Client::instance()) {
+    Mqtt::Mqtt()
+        : _certCache("/mqtt-cert", http::Client::instance()),
+          _backlog("/mqtt-backlog") {
       memset(&_cfg, 0, sizeof(esp_mqtt_client_config_t));
-      _uri = "mqtt://mqtt.lan";
+      _uri = CONFIG_ESP32M_NET_MQTT_URI;
       _cfg.session.keepalive = 120;
+      _outbox.onDrop([this](mqtt::Outgoing &message) {
+        if (message.store)
+          _backlog.add(message.topic.c_str(), message.payload.c_str(),
+                       message.qos, message.retain);
+      });
     }
 
     bool Mqtt::isReady() {
@@ -88,6 +126,10 @@ namespace esp32m {
         prev = _status;
         _status = status;
       }
+      if (status == Status::Ready)
+        _metrics.ready();
+      else if (prev == Status::Ready || prev == Status::Connected)
+        _metrics.disconnected();
       mqtt::StatusChanged ev(status, prev);
       ev.publish();
       xTaskNotifyGive(_task);
@@ -159,7 +201,7 @@ namespace esp32m {
       esp_task_wdt_add(NULL);
       for (;;) {
         esp_task_wdt_reset();
-        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(pendingWait()));
         if (!_enabled) {
           if (_status != Status::Initial)
             disconnect();
@@ -218,11 +260,57 @@ namespace esp32m {
             break;
           case Status::Disconnected:
             logI("disconnected");
+            // queued messages are stale by the time we reconnect; those
+            // that must not be lost move to the backlog
+            _outbox.clear();
             setState(Status::Initial);
             break;
           default:
             break;
         }
+        _metrics.tick();
+        if (isConnected()) {
+          refill();
+          flushOutbox();
+          if (isReady())
+            drainBacklog();
+        }
+      }
+    }
+
+    int Mqtt::pendingWait() {
+      bool backlogged = isReady() && !_backlog.empty();
+      if (!isConnected() || (_outbox.empty() && !backlogged))
+        return 1000;
+      refill();
+      if (canSend())
+        return _outbox.empty() ? 100 : 0;
+      return (1 - _tokens) * 1000 / _rate + 1;
+    }
+
+    void Mqtt::refill() {
+      auto now = millis();
+      _tokens += (float)(now - _refilledAt) * _rate / 1000;
+      if (_tokens > _burst)
+        _tokens = _burst;
+      _refilledAt = now;
+    }
+
+    void Mqtt::flushOutbox() {
+      mqtt::Outgoing message;
+      while (canSend() && _outbox.pop(message)) {
+        esp_task_wdt_reset();
+        spend();
+        bool sent = send(message.topic.c_str(), message.payload.c_str(),
+                         message.qos, message.retain);
+        if (!sent) {
+          _pubfail++;
+          if (message.store)
+            _backlog.add(message.topic.c_str(), message.payload.c_str(),
+                         message.qos, message.retain);
+        }
+        if (message.sent)
+          message.sent(sent);
       }
     }
 
@@ -234,7 +322,9 @@ namespace esp32m {
 
     DynamicJsonDocument *Mqtt::getState(const JsonVariantConst args) {
       char *client = (char *)effectiveClient();
-      size_t size = JSON_OBJECT_SIZE(5 + 1) + JSON_STRING_SIZE(_uri.size()) +
+      size_t size = JSON_OBJECT_SIZE(5 + 6) + JSON_OBJECT_SIZE(5) +
+                    Metrics::JsonSize +
+                    JSON_STRING_SIZE(_uri.size()) +
                     JSON_STRING_SIZE(strlen(client));
       auto doc = new DynamicJsonDocument(size);
       auto cr = doc->to<JsonObject>();
@@ -246,13 +336,27 @@ namespace esp32m {
       }
       cr["pubcnt"] = _pubcnt;
       cr["recvcnt"] = _recvcnt;
+      cr["backlog"] = _backlog.count();
+      cr["dropped"] = _backlog.dropped();
+      cr["oversized"] = _oversized;
+      auto outbox = cr.createNestedObject("outbox");
+      outbox["depth"] = _outbox.count();
+      outbox["bytes"] = _outbox.size();
+      outbox["dropped"] = _outbox.dropped();
+      outbox["coalesced"] = _outbox.coalesced();
+      outbox["failed"] = _pubfail;
+      _metrics.toJson(cr.createNestedObject("metrics"));
       return doc;
     }
 
     DynamicJsonDocument *Mqtt::getConfig(RequestContext &ctx) {
       size_t size =
-          JSON_OBJECT_SIZE(1 + 8) +  // mqtt: enabled, uri, username, password,
-                                     // client, cert_url, keepalive, timeout
+          JSON_OBJECT_SIZE(1 + 14) +  // mqtt: enabled, uri, username,
+                                      // password, client, cert_url,
+                                      // keepalive, timeout, max_payload,
+                                      // metrics_sensors, backlog, outbox,
+                                      // rate, burst
+          JSON_OBJECT_SIZE(3) +      // backlog: ram, spill, rate
           JSON_STRING_SIZE(_uri.size()) + JSON_STRING_SIZE(_username.size()) +
           JSON_STRING_SIZE(_password.size()) +
           JSON_STRING_SIZE(_client.size()) + JSON_STRING_SIZE(_certurl.size());
@@ -268,6 +372,15 @@ namespace esp32m {
       json::to(cr, "cert_url", _certurl);
       cr["keepalive"] = _cfg.session.keepalive;
       cr["timeout"] = _timeout;
+      cr["max_payload"] = _maxPayload;
+      cr["metrics_sensors"] = _metricsSensors;
+      auto backlog = cr.createNestedObject("backlog");
+      backlog["ram"] = _backlogRam;
+      backlog["spill"] = _backlogSpill;
+      backlog["rate"] = _backlogRate;
+      cr["outbox"] = _outboxSize;
+      cr["rate"] = _rate;
+      cr["burst"] = _burst;
       return doc;
     }
 
@@ -314,21 +427,63 @@ namespace esp32m {
       json::from(ca["timeout"], _timeout, &changed);
       if (_timeout < 1)
         _timeout = 1;
+      // these settings don't require reconnect
+      bool localChanged = false;
+      json::from(ca["max_payload"], _maxPayload, &localChanged);
+      json::from(ca["metrics_sensors"], _metricsSensors, &localChanged);
+      if (_metricsSensors && !_metricsDevice)
+        _metricsDevice.reset(new mqtt::MetricsDevice(_metrics, _outbox));
+      if (_metricsDevice)
+        _metricsDevice->enable(_metricsSensors);
+      auto backlog = ca["backlog"];
+      json::from(backlog["ram"], _backlogRam, &localChanged);
+      json::from(backlog["spill"], _backlogSpill, &localChanged);
+      json::from(backlog["rate"], _backlogRate, &localChanged);
+      if (_backlogRate < 1)
+        _backlogRate = 1;
+      json::from(ca["outbox"], _outboxSize, &localChanged);
+      json::from(ca["rate"], _rate, &localChanged);
+      json::from(ca["burst"], _burst, &localChanged);
+      if (_rate < 0)
+        _rate = 0;
+      if (_burst < 1)
+        _burst = 1;
+      _backlog.setLimits(_backlogRam, _backlogSpill);
+      _outbox.setLimit(_outboxSize);
       _configChanged = changed;
+      changed |= localChanged;
       if (_task)
         xTaskNotifyGive(_task);
       return changed;
     }
 
     bool Mqtt::publish(const char *topic, const char *message, int qos,
-                       bool retain) {
-      if (!_handle || !isConnected() || !topic || !message)
+                       bool retain, Lane lane, SentFunction sent) {
+      return push(topic, message, qos, retain, lane, false, std::move(sent));
+    }
+
+    bool Mqtt::push(const char *topic, const char *message, int qos,
+                    bool retain, Lane lane, bool store, SentFunction sent) {
+      if (!_handle || !isConnected() ||
+          !_outbox.push(topic, message, qos, retain, lane, store,
+                        std::move(sent)))
+        return false;
+      if (_task && xTaskGetCurrentTaskHandle() != _task)
+        xTaskNotifyGive(_task);
+      return true;
+    }
+
+    bool Mqtt::send(const char *topic, const char *message, int qos,
+                    bool retain) {
+      if (!_handle || !isConnected())
         return false;
       // logD("publish %s %s", topic, message);
       auto id = esp_mqtt_client_publish(_handle, topic, message,
                                         strlen(message), qos, retain);
-      if (id >= 0)
+      if (id >= 0) {
         _pubcnt++;
+        _metrics.sent(id, qos, strlen(topic) + strlen(message));
+      }
       return id >= 0;
     }
     bool Mqtt::enqueue(const char *topic, const char *message, int qos,
@@ -343,6 +498,37 @@ namespace esp32m {
       return id >= 0;
     }
 
+    bool Mqtt::deliver(const char *topic, const char *message, int qos,
+                       bool retain, Lane lane) {
+      if (!_enabled || !topic || !message)
+        return false;
+      if (_backlog.empty() &&
+          push(topic, message, qos, retain, lane, true, nullptr))
+        return true;
+      if (!_backlog.enabled())
+        return false;
+      _backlog.add(topic, message, qos, retain);
+      return true;
+    }
+
+    void Mqtt::drainBacklog() {
+      if (_backlog.empty())
+        return;
+      // we are called 10 times a second while there's something to send
+      auto budget = (_backlogRate + 9) / 10;
+      mqtt::Record record;
+      while (budget-- > 0 && canSend() && _backlog.peek(record)) {
+        esp_task_wdt_reset();
+        if (!send(record.topic.c_str(), record.payload.c_str(), record.qos,
+                  record.retain))
+          return;
+        spend();
+        _backlog.pop();
+      }
+      if (_backlog.empty())
+        logI("backlog sent, %d messages were dropped", _backlog.dropped());
+    }
+
     void Mqtt::setLwt(const char *topic, const char *message, int qos,
                       bool retain) {
       _lwt.set(topic, message, qos, retain);
@@ -379,24 +565,36 @@ namespace esp32m {
     }
 
     Subscription *Mqtt::subscribe(const char *topic, int qos) {
-      return this->subscribe(topic, nullptr, qos);
+      return this->subscribe(topic, HandlerFunction(), qos);
     }
     Subscription *Mqtt::subscribe(const char *topic, HandlerFunction handler,
                                   int qos) {
       if (!topic)
         return nullptr;
-      std::string t(topic);
-      auto id = ++subscriptionIdCounter;
-      auto sub = new Subscription(this, id, t, qos, handler);
+      return subscribe(new Subscription(this, ++subscriptionIdCounter, topic,
+                                        qos, handler));
+    }
+    Subscription *Mqtt::subscribe(const char *topic, StreamFunction handler,
+                                  int qos) {
+      if (!topic)
+        return nullptr;
+      auto sub = new Subscription(this, ++subscriptionIdCounter, topic, qos,
+                                  HandlerFunction());
+      sub->_stream = handler;
+      return subscribe(sub);
+    }
+    Subscription *Mqtt::subscribe(Subscription *sub) {
+      auto &t = sub->_topic;
       bool sendSubscribe;
       {
         std::lock_guard guard(_mutex);
         auto &subs = _subscriptions[t];
         sendSubscribe = subs.size() == 0 && isConnected();
-        subs[id] = sub;
+        subs[sub->id()] = sub;
+        _trie.add(t, sub);
       }
       if (sendSubscribe)
-        intSubscribe(t, qos);
+        intSubscribe(t, sub->qos());
       return sub;
     }
 
@@ -409,11 +607,12 @@ namespace esp32m {
         auto subsIt = _subscriptions.find(sub->topic());
         if (subsIt == _subscriptions.end())
           return;
-        auto subsByid = subsIt->second;
+        auto &subsByid = subsIt->second;
         auto subIt = subsByid.find(sub->id());
         if (subIt == subsByid.end())
           return;
         subsByid.erase(subIt);
+        _trie.remove(sub->topic(), sub);
         if (subsByid.size() == 0) {
           _subscriptions.erase(subsIt);
           sendUnsubscribe = isConnected();
@@ -433,6 +632,9 @@ namespace esp32m {
           setState(Status::Connected);
           _timer = 0;
           break;
+        case MQTT_EVENT_PUBLISHED:
+          _metrics.acked(event->msg_id);
+          break;
         case MQTT_EVENT_DISCONNECTED:
           setState(Status::Disconnected);
           break;
@@ -440,31 +642,87 @@ namespace esp32m {
           break;
         case MQTT_EVENT_UNSUBSCRIBED:
           break;
-        case MQTT_EVENT_DATA: {
-          std::string topic = std::string(event->topic, event->topic_len);
-          std::string payload = std::string(event->data, event->data_len);
-          _recvcnt++;
-          Incoming ev(topic, payload);
-          ev.publish();
-          std::vector<HandlerFunction> handlers;
-          {
-            std::lock_guard guard(_mutex);
-            auto it = _subscriptions.find(topic);
-            if (it != _subscriptions.end())
-              for (auto const &[id, sub] : it->second) {
-                auto fn = sub->_function;
-                if (fn)
-                  handlers.push_back(fn);
-              }
-          }
-          for (auto fn : handlers) fn(topic, payload);
-        } break;
+        case MQTT_EVENT_DATA:
+          receive(event);
+          break;
         default:
           break;
       }
       return 0;
     }
 
+    void Mqtt::receive(esp_mqtt_event_handle_t event) {
+      size_t offset = event->current_data_offset;
+      std::string_view chunk(event->data, event->data_len);
+      _metrics.received(chunk.size() + (offset ? 0 : event->topic_len));
+      // only the first chunk of a fragmented message carries the topic
+      if (offset == 0) {
+        _recvcnt++;
+        _inTopic.assign(event->topic, event->topic_len);
+        _inTotal = event->total_data_len;
+        _inNotify = false;
+        _handlers.clear();
+        _streams.clear();
+        {
+          std::lock_guard guard(_mutex);
+          _trie.match(_inTopic, [this](Subscription *sub) {
+            if (sub->_stream)
+              _streams.push_back(sub->_stream);
+            else if (sub->_function)
+              _handlers.push_back(sub->_function);
+            else
+              _inNotify = true;
+          });
+        }
+        // subscribers without a handler, or no subscriber at all: fall back
+        // to the event
+        if (_handlers.empty() && _streams.empty())
+          _inNotify = true;
+        _inReassemble = _inNotify || !_handlers.empty();
+        if (_inReassemble && _inTotal > _maxPayload) {
+          logW("dropping %d bytes payload of %s, limit is %d", (int)_inTotal,
+               _inTopic.c_str(), _maxPayload);
+          _oversized++;
+          _inReassemble = false;
+        }
+        _inPayload.clear();
+        // the buffer is kept across messages, drop it if the limit went down
+        if (_inPayload.capacity() > (size_t)_maxPayload)
+          std::string().swap(_inPayload);
+        if (_inReassemble && chunk.size() < _inTotal)
+          _inPayload.reserve(_inTotal);
+      } else if (_inTopic.empty())
+        return;  // we missed the beginning
+      if (_streams.size()) {
+        auto start = esp_timer_get_time();
+        for (auto &fn : _streams) fn(_inTopic, chunk, offset, _inTotal);
+        _metrics.handled(esp_timer_get_time() - start);
+      }
+      if (!_inReassemble)
+        return;
+      std::string_view payload;
+      if (offset == 0 && chunk.size() == _inTotal)
+        payload = chunk;  // not fragmented, no need to copy
+      else {
+        if (offset != _inPayload.size()) {
+          logW("fragment of %s out of order", _inTopic.c_str());
+          _inReassemble = false;
+          return;
+        }
+        _inPayload.append(chunk);
+        if (_inPayload.size() < _inTotal)
+          return;
+        payload = _inPayload;
+      }
+      auto start = esp_timer_get_time();
+      if (_inNotify) {
+        Incoming ev(_inTopic, payload);
+        ev.publish();
+      }
+      for (auto &fn : _handlers) fn(_inTopic, payload);
+      _metrics.handled(esp_timer_get_time() - start);
+    }
+
     void Mqtt::disconnect() {
       if (_status == Status::Disconnecting || _status == Status::Initial ||
           _status == Status::Disconnected)
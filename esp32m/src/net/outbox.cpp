@@ -0,0 +1,118 @@
+#include "esp32m/net/outbox.hpp"
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      void Outbox::setLimit(size_t limit) {
+        std::vector<Outgoing> dropped;
+        {
+          std::lock_guard guard(_mutex);
+          _limit = limit;
+          trim(dropped);
+        }
+        notify(dropped);
+      }
+
+      bool Outbox::push(const char *topic, const char *payload, int qos,
+                        bool retain, Lane lane, bool store,
+                        SentFunction sent) {
+        if (!topic || !payload)
+          return false;
+        std::vector<Outgoing> dropped;
+        {
+          std::lock_guard guard(_mutex);
+          bool coalesce = lane == Lane::State && qos == 0;
+          auto it = coalesce ? _states.find(topic) : _states.end();
+          if (it != _states.end()) {
+            auto message = it->second;
+            _size -= message->size();
+            message->payload = payload;
+            message->retain = retain;
+            message->store = store;
+            // the replaced message is superseded rather than lost, but its
+            // sender still has to hear about it
+            message->sent.swap(sent);
+            _size += message->size();
+            _coalesced++;
+          } else {
+            int index = lane == Lane::State ? (int)Lane::Telemetry : (int)lane;
+            auto &message = _lanes[index].emplace_back();
+            message.topic = topic;
+            message.payload = payload;
+            message.qos = qos;
+            message.retain = retain;
+            message.store = store;
+            message.sent = std::move(sent);
+            _size += message.size();
+            _count++;
+            if (coalesce)
+              _states[message.topic] = &message;
+          }
+          trim(dropped);
+        }
+        // now holds the callback of the replaced message, if any
+        if (sent)
+          sent(false);
+        notify(dropped);
+        return true;
+      }
+
+      bool Outbox::pop(Outgoing &message) {
+        std::lock_guard guard(_mutex);
+        for (int i = 0; i < Lanes; i++)
+          if (!_lanes[i].empty()) {
+            popFront(i, message);
+            return true;
+          }
+        return false;
+      }
+
+      void Outbox::clear() {
+        std::vector<Outgoing> dropped;
+        {
+          std::lock_guard guard(_mutex);
+          dropped.reserve(_count);
+          for (int i = 0; i < Lanes; i++) {
+            for (auto &message : _lanes[i])
+              dropped.push_back(std::move(message));
+            _lanes[i].clear();
+          }
+          _dropped += dropped.size();
+          _states.clear();
+          _size = _count = 0;
+        }
+        notify(dropped);
+      }
+
+      void Outbox::popFront(int lane, Outgoing &into) {
+        auto &message = _lanes[lane].front();
+        auto it = _states.find(message.topic);
+        if (it != _states.end() && it->second == &message)
+          _states.erase(it);
+        _size -= message.size();
+        into = std::move(message);
+        _lanes[lane].pop_front();
+        _count--;
+      }
+
+      void Outbox::trim(std::vector<Outgoing> &dropped) {
+        for (int i = Lanes - 1; i >= 0 && _size > _limit; i--)
+          while (_size > _limit && !_lanes[i].empty()) {
+            popFront(i, dropped.emplace_back());
+            _dropped++;
+          }
+      }
+
+      void Outbox::notify(std::vector<Outgoing> &dropped) {
+        for (auto &message : dropped) {
+          if (_onDrop)
+            _onDrop(message);
+          if (message.sent)
+            message.sent(false);
+        }
+      }
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
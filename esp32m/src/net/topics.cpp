@@ -0,0 +1,56 @@
+#include <algorithm>
+
+#include "esp32m/net/topics.hpp"
+
+namespace esp32m {
+  namespace net {
+    namespace mqtt {
+
+      void TopicTrie::add(std::string_view filter, Subscription *sub) {
+        auto node = &_root;
+        for (;;) {
+          auto slash = filter.find('/');
+          auto level = filter.substr(0, slash);
+          auto it = node->children.find(level);
+          if (it == node->children.end())
+            it = node->children
+                     .emplace(std::string(level), std::make_unique<Node>())
+                     .first;
+          node = it->second.get();
+          if (slash == std::string_view::npos)
+            break;
+          filter = filter.substr(slash + 1);
+        }
+        node->subs.push_back(sub);
+      }
+
+      void TopicTrie::remove(std::string_view filter, Subscription *sub) {
+        // remember the path to prune nodes that become empty
+        std::vector<std::pair<Node *, std::string_view> > path;
+        auto node = &_root;
+        for (;;) {
+          auto slash = filter.find('/');
+          auto level = filter.substr(0, slash);
+          auto it = node->children.find(level);
+          if (it == node->children.end())
+            return;
+          path.emplace_back(node, level);
+          node = it->second.get();
+          if (slash == std::string_view::npos)
+            break;
+          filter = filter.substr(slash + 1);
+        }
+        auto &subs = node->subs;
+        subs.erase(std::remove(subs.begin(), subs.end(), sub), subs.end());
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+          auto child = it->first->children.find(it->second);
+          if (!child->second->subs.empty() ||
+              !child->second->children.empty())
+            break;
+          it->first->children.erase(child);
+        }
+      }
+
+    }  // namespace mqtt
+  }    // namespace net
+}  // namespace esp32m
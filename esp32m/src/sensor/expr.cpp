@@ -0,0 +1,300 @@
+#include "esp32m/sensor/expr.hpp"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+namespace esp32m {
+  namespace sensor {
+
+    /**
+     * Recursive descent parser that emits code as it goes, keeping track of
+     * the stack depth the code needs
+     */
+    class Compiler {
+     public:
+      Compiler(Expression &target, const char *source)
+          : _target(target), _p(source) {}
+      bool run() {
+        skip();
+        if (!*_p)
+          return fail("empty expression");
+        if (!expr())
+          return false;
+        if (*_p)
+          return fail("unexpected character");
+        return true;
+      }
+
+     private:
+      typedef Expression::Op Op;
+      Expression &_target;
+      const char *_p;
+      int _depth = 0, _nesting = 0;
+
+      bool fail(const char *msg) {
+        if (_target._error.empty())
+          _target._error = msg;
+        return false;
+      }
+      void skip() {
+        while (isspace((unsigned char)*_p)) _p++;
+      }
+      bool accept(char c) {
+        if (*_p != c)
+          return false;
+        _p++;
+        skip();
+        return true;
+      }
+      bool emit(Op op, int index = 0) {
+        switch (op) {
+          case Op::Const:
+          case Op::Input:
+            if (++_depth > Expression::MaxStack)
+              return fail("expression is too complex");
+            break;
+          case Op::Neg:
+          case Op::Abs:
+          case Op::Sqrt:
+          case Op::Ln:
+          case Op::Exp:
+            break;
+          default:
+            _depth--;
+            break;
+        }
+        _target._code.push_back({op, (uint8_t)index});
+        return true;
+      }
+      bool constant(float value) {
+        auto &constants = _target._constants;
+        auto it = std::find(constants.begin(), constants.end(), value);
+        if (it == constants.end()) {
+          if (constants.size() > UINT8_MAX)
+            return fail("too many constants");
+          it = constants.insert(constants.end(), value);
+        }
+        return emit(Op::Const, it - constants.begin());
+      }
+      bool input(std::string name) {
+        auto &inputs = _target._inputs;
+        auto it = std::find(inputs.begin(), inputs.end(), name);
+        if (it == inputs.end()) {
+          if (inputs.size() >= Expression::MaxInputs)
+            return fail("too many inputs");
+          it = inputs.insert(inputs.end(), std::move(name));
+        }
+        return emit(Op::Input, it - inputs.begin());
+      }
+      // expr := term (('+' | '-') term)*
+      bool expr() {
+        if (!term())
+          return false;
+        for (;;) {
+          if (accept('+')) {
+            if (!term() || !emit(Op::Add))
+              return false;
+          } else if (accept('-')) {
+            if (!term() || !emit(Op::Sub))
+              return false;
+          } else
+            return true;
+        }
+      }
+      // term := unary (('*' | '/') unary)*
+      bool term() {
+        if (!unary())
+          return false;
+        for (;;) {
+          if (accept('*')) {
+            if (!unary() || !emit(Op::Mul))
+              return false;
+          } else if (accept('/')) {
+            if (!unary() || !emit(Op::Div))
+              return false;
+          } else
+            return true;
+        }
+      }
+      // unary := '-' unary | power
+      bool unary() {
+        bool negate = *_p == '-';
+        if (accept('-') || accept('+')) {
+          while (*_p == '-' || *_p == '+') {
+            negate ^= *_p == '-';
+            accept(*_p);
+          }
+          return power() && (!negate || emit(Op::Neg));
+        }
+        return power();
+      }
+      // power := primary ('^' unary)?, right associative
+      bool power() {
+        if (!primary())
+          return false;
+        if (accept('^'))
+          return unary() && emit(Op::Pow);
+        return true;
+      }
+      // primary := number | name | function '(' args ')' | '(' expr ')'
+      bool primary() {
+        if (accept('(')) {
+          // bounds recursion, deeper nesting would overflow the stack anyway
+          if (++_nesting > Expression::MaxStack)
+            return fail("expression is too complex");
+          if (!expr() || !(accept(')') || fail("missing ')'")))
+            return false;
+          _nesting--;
+          return true;
+        }
+        if (isdigit((unsigned char)*_p) || *_p == '.') {
+          char *end;
+          float value = strtof(_p, &end);
+          if (end == _p)
+            return fail("invalid number");
+          _p = end;
+          skip();
+          return constant(value);
+        }
+        if (*_p == '\'') {
+          auto start = ++_p;
+          while (*_p && *_p != '\'') _p++;
+          if (!*_p)
+            return fail("missing closing quote");
+          std::string name(start, _p - start);
+          _p++;
+          skip();
+          return input(std::move(name));
+        }
+        if (isalpha((unsigned char)*_p) || *_p == '_') {
+          auto start = _p;
+          while (isalnum((unsigned char)*_p) || *_p == '_' || *_p == '.') _p++;
+          std::string name(start, _p - start);
+          skip();
+          if (accept('('))
+            return call(name.c_str());
+          return input(std::move(name));
+        }
+        return fail(*_p ? "unexpected character" : "unexpected end");
+      }
+      bool call(const char *name) {
+        static const struct {
+          const char *name;
+          Op op;
+          int minArgs, maxArgs;
+        } functions[] = {
+            {"abs", Op::Abs, 1, 1},      {"sqrt", Op::Sqrt, 1, 1},
+            {"ln", Op::Ln, 1, 1},        {"exp", Op::Exp, 1, 1},
+            {"pow", Op::Pow, 2, 2},      {"min", Op::Min, 1, INT16_MAX},
+            {"max", Op::Max, 1, INT16_MAX},
+        };
+        if (++_nesting > Expression::MaxStack)
+          return fail("expression is too complex");
+        for (auto &f : functions)
+          if (!strcmp(f.name, name)) {
+            int args = 0;
+            if (!accept(')'))
+              do {
+                if (!expr())
+                  return false;
+                // variadic min/max fold arguments as they come
+                if (++args > 1 && f.maxArgs > 2 && !emit(f.op))
+                  return false;
+              } while (accept(','));
+            if (args && !accept(')'))
+              return fail("missing ')'");
+            if (args < f.minArgs || args > f.maxArgs)
+              return fail("wrong number of arguments");
+            if (f.maxArgs <= 2 && !emit(f.op))
+              return false;
+            _nesting--;
+            return true;
+          }
+        return fail("unknown function");
+      }
+    };
+
+    bool Expression::compile(const char *source) {
+      _code.clear();
+      _constants.clear();
+      _inputs.clear();
+      _error.clear();
+      if (source && Compiler(*this, source).run()) {
+        _code.shrink_to_fit();
+        _constants.shrink_to_fit();
+        return true;
+      }
+      if (_error.empty())
+        _error = "no expression";
+      _code.clear();
+      return false;
+    }
+
+    bool Expression::evaluate(const float *values, float &result) const {
+      if (_code.empty())
+        return false;
+      float stack[MaxStack];
+      int sp = 0;
+      for (auto &instr : _code) {
+        switch (instr.op) {
+          case Op::Const:
+            stack[sp++] = _constants[instr.index];
+            continue;
+          case Op::Input:
+            stack[sp++] = values[instr.index];
+            continue;
+          case Op::Neg:
+            stack[sp - 1] = -stack[sp - 1];
+            continue;
+          case Op::Abs:
+            stack[sp - 1] = fabsf(stack[sp - 1]);
+            continue;
+          case Op::Sqrt:
+            stack[sp - 1] = sqrtf(stack[sp - 1]);
+            continue;
+          case Op::Ln:
+            stack[sp - 1] = logf(stack[sp - 1]);
+            continue;
+          case Op::Exp:
+            stack[sp - 1] = expf(stack[sp - 1]);
+            continue;
+          default:
+            break;
+        }
+        auto b = stack[--sp];
+        auto &a = stack[sp - 1];
+        switch (instr.op) {
+          case Op::Add:
+            a += b;
+            break;
+          case Op::Sub:
+            a -= b;
+            break;
+          case Op::Mul:
+            a *= b;
+            break;
+          case Op::Div:
+            a /= b;
+            break;
+          case Op::Pow:
+            a = powf(a, b);
+            break;
+          case Op::Min:
+            a = std::min(a, b);
+            break;
+          case Op::Max:
+            a = std::max(a, b);
+            break;
+          default:
+            break;
+        }
+      }
+      result = stack[0];
+      return isfinite(result);
+    }
+
+  }  // namespace sensor
+}  // namespace esp32m
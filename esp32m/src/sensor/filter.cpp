@@ -0,0 +1,215 @@
+#include "esp32m/sensor/filter.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+namespace esp32m {
+  namespace sensor {
+
+    namespace filter {
+
+      /**
+       * Circular buffer of the last @c size samples
+       */
+      class Window {
+       public:
+        Window(int size) : _data(new float[size]), _size(size) {}
+        int count() const {
+          return _count;
+        }
+        bool full() const {
+          return _count == _size;
+        }
+        void push(float value) {
+          _data[_pos] = value;
+          _pos = (_pos + 1) % _size;
+          if (_count < _size)
+            _count++;
+        }
+        float sum() const {
+          float result = 0;
+          for (int i = 0; i < _count; i++) result += _data[i];
+          return result;
+        }
+        float median() const {
+          float tmp[Filter::MaxWindow];
+          memcpy(tmp, _data.get(), _count * sizeof(float));
+          return median(tmp, _count);
+        }
+        /**
+         * @return median absolute deviation from @c center
+         */
+        float deviation(float center) const {
+          float tmp[Filter::MaxWindow];
+          for (int i = 0; i < _count; i++) tmp[i] = fabsf(_data[i] - center);
+          return median(tmp, _count);
+        }
+        void reset() {
+          _count = _pos = 0;
+        }
+
+       private:
+        std::unique_ptr<float[]> _data;
+        int _size, _count = 0, _pos = 0;
+        static float median(float *values, int count) {
+          auto mid = values + count / 2;
+          std::nth_element(values, mid, values + count);
+          if (count & 1)
+            return *mid;
+          return (*mid + *std::max_element(values, mid)) / 2;
+        }
+      };
+
+      class MovingAverage : public Filter {
+       public:
+        MovingAverage(int size) : _window(size) {}
+        bool process(float &value) override {
+          _window.push(value);
+          // summing the window every time does not accumulate rounding errors
+          value = _window.sum() / _window.count();
+          return true;
+        }
+        void reset() override {
+          _window.reset();
+        }
+
+       private:
+        Window _window;
+      };
+
+      class Ema : public Filter {
+       public:
+        Ema(float alpha) : _alpha(alpha) {}
+        bool process(float &value) override {
+          if (isnan(_value))
+            _value = value;
+          else
+            _value += _alpha * (value - _value);
+          value = _value;
+          return true;
+        }
+        void reset() override {
+          _value = NAN;
+        }
+
+       private:
+        float _alpha;
+        float _value = NAN;
+      };
+
+      class Median : public Filter {
+       public:
+        Median(int size) : _window(size) {}
+        bool process(float &value) override {
+          _window.push(value);
+          value = _window.median();
+          return true;
+        }
+        void reset() override {
+          _window.reset();
+        }
+
+       private:
+        Window _window;
+      };
+
+      /**
+       * Drops samples that deviate from the median of recently accepted
+       * samples by more than @c threshold scaled median absolute deviations
+       * (Hampel identifier). If as many consecutive samples as the window
+       * holds are rejected, the signal is assumed to have shifted and the
+       * window starts over.
+       */
+      class Outlier : public Filter {
+       public:
+        Outlier(int size, float threshold, float delta)
+            : _window(size), _size(size), _threshold(threshold), _delta(delta) {}
+        bool process(float &value) override {
+          if (_window.count() >= 3) {
+            auto median = _window.median();
+            // 1.4826 makes MAD consistent with standard deviation
+            auto limit = std::max(
+                _threshold * 1.4826f * _window.deviation(median), _delta);
+            if (fabsf(value - median) > limit) {
+              if (++_rejected < _size)
+                return false;
+              _window.reset();
+            }
+          }
+          _rejected = 0;
+          _window.push(value);
+          return true;
+        }
+        void reset() override {
+          _window.reset();
+          _rejected = 0;
+        }
+
+       private:
+        Window _window;
+        int _size;
+        float _threshold, _delta;
+        int _rejected = 0;
+      };
+
+      class Decimate : public Filter {
+       public:
+        Decimate(int factor) : _factor(factor) {}
+        bool process(float &value) override {
+          if (++_counter < _factor)
+            return false;
+          _counter = 0;
+          return true;
+        }
+        void reset() override {
+          _counter = 0;
+        }
+
+       private:
+        int _factor;
+        int _counter = 0;
+      };
+
+    }  // namespace filter
+
+    Filter *Filter::create(JsonObjectConst cfg) {
+      auto type = cfg["type"].as<const char *>();
+      if (!type)
+        return nullptr;
+      int size = cfg["size"] | 5;
+      bool sizeValid = size > 0 && size <= MaxWindow;
+      if (!strcmp(type, "ma"))
+        return sizeValid ? new filter::MovingAverage(size) : nullptr;
+      if (!strcmp(type, "ema")) {
+        float alpha = cfg["alpha"] | 0.5f;
+        return alpha > 0 && alpha <= 1 ? new filter::Ema(alpha) : nullptr;
+      }
+      if (!strcmp(type, "median"))
+        return sizeValid ? new filter::Median(size) : nullptr;
+      if (!strcmp(type, "outlier")) {
+        float threshold = cfg["threshold"] | 3.0f;
+        float delta = cfg["delta"] | 0.0f;
+        return sizeValid && threshold > 0 && delta >= 0
+                   ? new filter::Outlier(size, threshold, delta)
+                   : nullptr;
+      }
+      if (!strcmp(type, "decimate")) {
+        int factor = cfg["factor"] | 2;
+        return factor > 0 ? new filter::Decimate(factor) : nullptr;
+      }
+      return nullptr;
+    }
+
+    Pipeline *Pipeline::create(JsonArrayConst cfg) {
+      auto pipeline = new Pipeline();
+      for (auto item : cfg) {
+        auto filter = Filter::create(item.as<JsonObjectConst>());
+        if (filter)
+          pipeline->_filters.emplace_back(filter);
+      }
+      return pipeline;
+    }
+
+  }  // namespace sensor
+}  // namespace esp32m
@@ -1,5 +1,8 @@
 #include "esp32m/ui/httpd.hpp"
 #include "esp32m/defs.hpp"
+#include "esp32m/deflate.hpp"
+#include "esp32m/events/response.hpp"
+#include "esp32m/json.hpp"
 #include "esp32m/logging.hpp"
 #include "esp32m/net/mdns.hpp"
 #include "esp32m/net/wifi.hpp"
@@ -7,8 +10,16 @@
 #include "esp32m/ui/asset.hpp"
 #include "esp32m/version.h"
 
+#include <esp_app_desc.h>
+#include <esp_idf_version.h>
+#include <esp_task_wdt.h>
+#include <errno.h>
 #include <mdns.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <algorithm>
+#include <deque>
+#include <string_view>
 #include <vector>
 
 namespace esp32m {
@@ -16,6 +27,9 @@ namespace esp32m {
     const char *UriWs = "/ws";
     const char *UriRoot = "/";
     const char *UriApp = "/app/shell";
+    const char *UriApi = "/api/";
+    // transport of responses to HTTP API requests
+    const char *ApiTransport = "ui-http-api";
 
     std::vector<Httpd *> _httpdServers;
 
@@ -74,6 +88,10 @@ namespace esp32m {
     void closeFn(httpd_handle_t hd, int sockfd) {
       Httpd *httpd = (Httpd *)httpd_get_global_user_ctx(hd);
       httpd->sessionClosed(sockfd);
+      {
+        std::lock_guard<std::mutex> guard(httpd->_wsMutex);
+        httpd->_ws.erase(sockfd);
+      }
       close(sockfd);
     }
 
@@ -82,6 +100,7 @@ namespace esp32m {
     // that has been registered by httpd_register_uri_handler(): 
     //
     // uriMatcher checks for 
+    //  - uri starts with "/api/", which is matched to the HTTP API, UriApi,
     //  - uri == "/ws", which is matched to the esp32m websocket API interface UriWs, 
     //  - uri starts with "/app", which allows an application to handle additional uris after esp32m has started).
     // 
@@ -98,6 +117,10 @@ namespace esp32m {
     bool uriMatcher(const char *registered_uri, const char *incoming_uri, size_t match_upto) {
       logd("Check registered uri: %s \n", registered_uri);
 
+      // check for /api/<target>/<name>
+      if (strcmp(registered_uri, UriApi) == 0)
+        return !strncmp(incoming_uri, UriApi, strlen(UriApi));
+
       // check for /ws
       if (strcmp(registered_uri, UriWs)==0){
         if (!strcmp(incoming_uri, UriWs)){
@@ -109,8 +132,9 @@ namespace esp32m {
 
        // default to root handler
       if (strcmp(registered_uri, UriRoot)==0){
-        // if not app
-        if (strncmp(incoming_uri, UriApp, strlen(UriApp))){
+        // if not app or api
+        if (strncmp(incoming_uri, UriApp, strlen(UriApp)) &&
+            strncmp(incoming_uri, UriApi, strlen(UriApi))) {
           logd("Matched system uri %s", incoming_uri);
         return true;
         }
@@ -143,6 +167,10 @@ namespace esp32m {
       return httpd->incomingWs(req);
     }
 
+    esp_err_t apiHandler(httpd_req_t *req) {
+      return ((Httpd *)req->user_ctx)->incomingApi(req);
+    }
+
     esp_err_t httpHandler(httpd_req_t *req) {
       Httpd *httpd = (Httpd *)req->user_ctx;
       if (!httpd) {
@@ -167,20 +195,637 @@ namespace esp32m {
       return ESP_ERR_NOT_FOUND;
     }
 
+    std::string_view trim(std::string_view s) {
+      while (!s.empty() && s.front() == ' ') s.remove_prefix(1);
+      while (!s.empty() && s.back() == ' ') s.remove_suffix(1);
+      return s;
+    }
+
+    // checks Accept-Encoding header for the given coding, q=0 refuses it
+    bool acceptsEncoding(std::string_view header, const char *encoding) {
+      if (!encoding)
+        return true;  // identity
+      bool wildcard = false;
+      while (!header.empty()) {
+        auto comma = header.find(',');
+        auto item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view()
+                                                 : header.substr(comma + 1);
+        auto semi = item.find(';');
+        auto coding = trim(item.substr(0, semi));
+        bool refused = false;
+        if (semi != std::string_view::npos) {
+          auto q = trim(item.substr(semi + 1));
+          refused = q.size() > 2 && q.substr(0, 2) == "q=" &&
+                    q.find_first_not_of("0.", 2) == std::string_view::npos;
+        }
+        if (coding.size() == strlen(encoding) &&
+            !strncasecmp(coding.data(), encoding, coding.size()))
+          return !refused;
+        if (coding == "*")
+          wildcard = !refused;
+      }
+      return wildcard;
+    }
+
+    // the smallest variant the client accepts, or the first one if none
+    // is acceptable, as all browsers handle gzip anyway
+    const Asset *selectEncoding(const std::vector<const Asset *> &variants,
+                                std::string_view accept) {
+      const Asset *best = nullptr;
+      for (auto a : variants)
+        if (acceptsEncoding(accept, a->_contentEncoding) &&
+            (!best || a->size() < best->size()))
+          best = a;
+      return best ? best : variants.front();
+    }
+
+    // size of the slices large assets are sent in; larger assets are sent
+    // by the asset task
+    const size_t AssetSlice = 4096;
+    // how long the asset task waits when no client can take more data, in
+    // milliseconds
+    const int AssetWait = 20;
+
+    /**
+     * Body of an asset being sent by the asset task, the request is taken
+     * over with httpd_req_async_handler_begin()
+     */
+    struct AssetTransfer {
+      httpd_req_t *req;
+      std::string head;
+      const uint8_t *data;
+      size_t len, pos = 0;
+      // millis() of the last slice the client took
+      unsigned long progressAt;
+    };
+
+    // build time of the firmware, as the assets are embedded in it
+    const char *lastModified() {
+      static char buf[32] = {};
+      if (!buf[0]) {
+        static const char *months[] = {"Jan", "Feb", "Mar", "Apr",
+                                       "May", "Jun", "Jul", "Aug",
+                                       "Sep", "Oct", "Nov", "Dec"};
+        auto desc = esp_app_get_description();
+        // __DATE__ and __TIME__ formats: "Mmm dd yyyy", "hh:mm:ss"
+        struct tm tm = {};
+        char month[4] = {};
+        sscanf(desc->date, "%3s %d %d", month, &tm.tm_mday, &tm.tm_year);
+        sscanf(desc->time, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+        tm.tm_year -= 1900;
+        for (int i = 0; i < 12; i++)
+          if (!strcmp(month, months[i]))
+            tm.tm_mon = i;
+        // the build time is taken as UTC, mktime() would apply the local
+        // time zone; days since epoch of a proleptic Gregorian date
+        int y = tm.tm_year + 1900 - (tm.tm_mon < 2);
+        int era = y / 400;
+        int yoe = y - era * 400;
+        int doy = (153 * (tm.tm_mon + (tm.tm_mon < 2 ? 10 : -2)) + 2) / 5 +
+                  tm.tm_mday - 1;
+        int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        time_t t = ((time_t)era * 146097 + doe - 719468) * 86400 +
+                   tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+        // normalizes the fields and fills in the day of week
+        gmtime_r(&t, &tm);
+        strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+      }
+      return buf;
+    }
+
+    // only single byte ranges are supported, requests for several ranges
+    // are answered with the whole asset
+    Range parseRange(const std::string &header, size_t size, size_t &from,
+                     size_t &to) {
+      if (header.rfind("bytes=", 0) != 0 ||
+          header.find(',') != std::string::npos)
+        return Range::None;
+      auto spec = header.c_str() + 6;
+      auto dash = strchr(spec, '-');
+      if (!dash)
+        return Range::None;
+      char *end;
+      if (dash == spec) {
+        // suffix range: the last N bytes
+        auto n = strtoul(dash + 1, &end, 10);
+        if (end == dash + 1 || *end)
+          return Range::None;
+        if (!n)
+          return Range::Unsatisfiable;
+        from = size - std::min((size_t)n, size);
+        to = size - 1;
+        return Range::Satisfiable;
+      }
+      auto first = strtoul(spec, &end, 10);
+      if (end != dash)
+        return Range::None;
+      size_t last = size - 1;
+      if (dash[1]) {
+        last = strtoul(dash + 1, &end, 10);
+        if (*end || last < first)
+          return Range::None;
+      }
+      if (first >= size)
+        return Range::Unsatisfiable;
+      from = first;
+      to = std::min(last, size - 1);
+      return Range::Satisfiable;
+    }
+
+    esp_err_t sendAll(httpd_req_t *req, const char *data, size_t len) {
+      while (len) {
+        int sent = httpd_send(req, data, len);
+        if (sent < 0)
+          return ESP_FAIL;
+        data += sent;
+        len -= sent;
+      }
+      return ESP_OK;
+    }
+
+    // messages shorter than this are sent uncompressed, the few bytes saved
+    // don't pay for the CPU time
+    const size_t WsCompressMin = 256;
+    // match distance limit of outgoing messages
+    const int WsWindowBits = 12;
+    // size limit of a decompressed incoming message
+    const size_t WsInflateMax = 32768;
+    // longer request header lines are truncated
+    const size_t WsMaxLine = 256;
+
+    /**
+     * esp_http_server doesn't support websocket extensions, so
+     * permessage-deflate (RFC 7692) is negotiated by watching the raw bytes
+     * of the connection: the offer is picked from the request headers, the
+     * response is added to the 101 response, and headers of incoming frames
+     * are parsed for the RSV1 bit that the server doesn't report. Neither
+     * side keeps context between messages, so a connection costs no
+     * compression state.
+     */
+    struct WsSession {
+      bool upgraded = false;
+      // permessage-deflate is in effect
+      bool deflate = false;
+      int windowBits = WsWindowBits;
+      // the incoming message being received is compressed
+      bool compressed = false;
+      // outgoing frames the socket didn't take yet, possibly shared with
+      // other sessions, and how much of the first one was sent
+      std::deque<std::shared_ptr<const std::string> > out;
+      size_t outPos = 0;
+
+      /**
+       * Writes as much of the pending output as the socket takes without
+       * blocking
+       * @return @c false if the connection failed
+       */
+      bool flush(int fd) {
+        while (!out.empty()) {
+          auto &frame = *out.front();
+          while (outPos < frame.size()) {
+            int sent = send(fd, frame.data() + outPos, frame.size() - outPos,
+                            MSG_DONTWAIT);
+            if (sent < 0) {
+              if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+              out.clear();
+              outPos = 0;
+              return false;
+            }
+            outPos += sent;
+          }
+          out.pop_front();
+          outPos = 0;
+        }
+        return true;
+      }
+
+      /**
+       * Queues frames that the server sends on its own, such as PONG and
+       * CLOSE, behind ours. The server hands them over as a header and a
+       * payload, so a frame is queued only once it is complete, and can't
+       * end up inside or between the pieces of one of ours.
+       */
+      void sendingFrames(const char *data, size_t len) {
+        _sending.append(data, len);
+        for (;;) {
+          auto h = (const uint8_t *)_sending.data();
+          if (_sending.size() < 2)
+            return;
+          uint64_t l = h[1] & 0x7f;
+          size_t n = l == 126 ? 2 : l == 127 ? 8 : 0;
+          size_t head = 2 + n + (h[1] & 0x80 ? 4 : 0);
+          if (_sending.size() < head)
+            return;
+          if (n) {
+            l = 0;
+            for (size_t i = 0; i < n; i++) l = (l << 8) | h[2 + i];
+          }
+          if (_sending.size() - head < l)
+            return;
+          out.push_back(std::make_shared<const std::string>(
+              _sending.substr(0, head + l)));
+          _sending.erase(0, head + l);
+        }
+      }
+
+      void received(const char *data, size_t len) {
+        if (!upgraded)
+          parseHead(data, len);
+        else if (deflate)
+          parseFrames((const uint8_t *)data, len);
+      }
+
+      /**
+       * Called with every chunk sent before the upgrade
+       * @return extension response to insert into the 101 response, if any
+       */
+      const char *sending(std::string_view data) {
+        if (data.substr(0, 13) == "HTTP/1.1 101 ") {
+          upgraded = true;
+          deflate = _offered;
+          windowBits = _offerBits;
+        } else if (data.substr(0, 7) == "HTTP/1.")
+          // the next request starts after the response
+          resetHead();
+        if (!deflate)
+          return nullptr;
+        _response = string_printf(
+            "Sec-WebSocket-Extensions: permessage-deflate; "
+            "server_no_context_takeover; client_no_context_takeover; "
+            "server_max_window_bits=%d\r\n",
+            windowBits);
+        return _response.c_str();
+      }
+
+     private:
+      std::string _line, _response;
+      // frame being handed over by the server in pieces
+      std::string _sending;
+      bool _body = false, _offered = false;
+      int _offerBits = WsWindowBits;
+      uint8_t _header[14];
+      size_t _headerLen = 0, _headerNeed = 2;
+      uint64_t _payload = 0;
+
+      void resetHead() {
+        _line.clear();
+        _body = _offered = false;
+        _offerBits = WsWindowBits;
+      }
+
+      void parseHead(const char *data, size_t len) {
+        for (; len && !_body; data++, len--)
+          if (*data == '\n') {
+            std::string_view line(_line);
+            if (!line.empty() && line.back() == '\r')
+              line.remove_suffix(1);
+            if (line.empty())
+              _body = true;
+            else if (!_offered) {
+              static const char Name[] = "sec-websocket-extensions:";
+              if (line.size() > sizeof(Name) - 1 &&
+                  !strncasecmp(line.data(), Name, sizeof(Name) - 1))
+                parseOffers(line.substr(sizeof(Name) - 1));
+            }
+            _line.clear();
+          } else if (_line.size() < WsMaxLine)
+            _line += *data;
+      }
+
+      // picks the first permessage-deflate offer with parameters we support
+      void parseOffers(std::string_view value) {
+        while (!value.empty() && !_offered) {
+          auto comma = value.find(',');
+          auto offer = value.substr(0, comma);
+          value = comma == std::string_view::npos ? std::string_view()
+                                                  : value.substr(comma + 1);
+          auto semi = offer.find(';');
+          if (trim(offer.substr(0, semi)) != "permessage-deflate")
+            continue;
+          bool ok = true;
+          int bits = WsWindowBits;
+          while (ok && semi != std::string_view::npos) {
+            offer = offer.substr(semi + 1);
+            semi = offer.find(';');
+            auto param = trim(offer.substr(0, semi));
+            auto eq = param.find('=');
+            auto name = trim(param.substr(0, eq));
+            if (name == "server_max_window_bits") {
+              auto v = eq == std::string_view::npos
+                           ? std::string_view()
+                           : trim(param.substr(eq + 1));
+              if (v.size() > 2 && v.front() == '"' && v.back() == '"')
+                v = v.substr(1, v.size() - 2);
+              int n = v.size() == 1 || v.size() == 2
+                          ? atoi(std::string(v).c_str())
+                          : 0;
+              ok = n >= 8 && n <= 15;
+              bits = std::min(bits, n);
+            } else
+              ok = name == "server_no_context_takeover" ||
+                   name == "client_no_context_takeover" ||
+                   name == "client_max_window_bits";
+          }
+          if (ok) {
+            _offered = true;
+            _offerBits = bits;
+          }
+        }
+      }
+
+      void parseFrames(const uint8_t *data, size_t len) {
+        while (len) {
+          if (_payload) {
+            auto n = (size_t)std::min(_payload, (uint64_t)len);
+            _payload -= n;
+            data += n;
+            len -= n;
+            continue;
+          }
+          _header[_headerLen++] = *data++;
+          len--;
+          if (_headerLen == 2) {
+            auto l = _header[1] & 0x7f;
+            _headerNeed = 2 + (l == 126 ? 2 : l == 127 ? 8 : 0) +
+                          (_header[1] & 0x80 ? 4 : 0);
+          }
+          if (_headerLen < _headerNeed)
+            continue;
+          uint64_t l = _header[1] & 0x7f;
+          if (l >= 126) {
+            int n = l == 126 ? 2 : 8;
+            l = 0;
+            for (int i = 0; i < n; i++) l = (l << 8) | _header[2 + i];
+          }
+          // RSV1 is set on the first frame of a compressed message only,
+          // continuation and control frames leave the flag alone
+          auto opcode = _header[0] & 0x0f;
+          if (opcode == HTTPD_WS_TYPE_TEXT || opcode == HTTPD_WS_TYPE_BINARY)
+            compressed = _header[0] & 0x40;
+          _payload = l;
+          _headerLen = 0;
+          _headerNeed = 2;
+        }
+      }
+    };
+
+    int sockResult(int ret) {
+      if (ret >= 0)
+        return ret;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return HTTPD_SOCK_ERR_TIMEOUT;
+      return HTTPD_SOCK_ERR_FAIL;
+    }
+
+    int recvFn(httpd_handle_t hd, int sockfd, char *buf, size_t buf_len,
+               int flags) {
+      if (!buf)
+        return HTTPD_SOCK_ERR_INVALID;
+      int ret = sockResult(recv(sockfd, buf, buf_len, flags));
+      if (ret > 0 && !(flags & MSG_PEEK)) {
+        Httpd *httpd = (Httpd *)httpd_get_global_user_ctx(hd);
+        std::lock_guard<std::mutex> guard(httpd->_wsMutex);
+        auto &session = httpd->_ws[sockfd];
+        if (!session)
+          session = std::make_unique<WsSession>();
+        session->received(buf, ret);
+      }
+      return ret;
+    }
+
+    int sendFn(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len,
+               int flags) {
+      if (!buf)
+        return HTTPD_SOCK_ERR_INVALID;
+      std::string response;
+      Httpd *httpd = (Httpd *)httpd_get_global_user_ctx(hd);
+      bool upgraded = false, ok, pending;
+      {
+        std::lock_guard<std::mutex> guard(httpd->_wsMutex);
+        auto it = httpd->_ws.find(sockfd);
+        std::string_view data(buf, buf_len);
+        // once upgraded, our frames go through the session output, the
+        // server's own frames must take the same way to keep the order
+        if (it != httpd->_ws.end() && it->second->upgraded) {
+          upgraded = true;
+          it->second->sendingFrames(buf, buf_len);
+          ok = it->second->flush(sockfd);
+          pending = !it->second->out.empty();
+        }
+        // the handshake response is sent in one piece, ending with an
+        // empty line
+        if (it != httpd->_ws.end() && !it->second->upgraded) {
+          auto extension = it->second->sending(data);
+          if (extension) {
+            if (data.size() >= 4 &&
+                data.substr(data.size() - 4) == "\r\n\r\n") {
+              response.assign(data.substr(0, data.size() - 2));
+              response += extension;
+              response += "\r\n";
+            } else
+              it->second->deflate = false;
+          }
+        }
+      }
+      if (upgraded) {
+        if (!ok)
+          return HTTPD_SOCK_ERR_FAIL;
+        // the rest is sent by the transmit task
+        if (pending)
+          httpd->outputPending();
+        return buf_len;
+      }
+      if (response.empty())
+        return sockResult(send(sockfd, buf, buf_len, flags));
+      for (size_t pos = 0; pos < response.size();) {
+        int ret = sockResult(send(sockfd, response.data() + pos,
+                                  response.size() - pos, flags));
+        if (ret < 0)
+          return ret;
+        pos += ret;
+      }
+      return buf_len;
+    }
+
+    esp_err_t openFn(httpd_handle_t hd, int sockfd) {
+      httpd_sess_set_recv_override(hd, sockfd, recvFn);
+      httpd_sess_set_send_override(hd, sockfd, sendFn);
+      return ESP_OK;
+    }
+
+    // largest request body accepted by the API
+    const size_t ApiMaxBody = 16384;
+    // how long to wait for a deferred response, in milliseconds
+    const int ApiTimeout = 30000;
+    // longest single wait for it, to keep the task watchdog fed
+    const int ApiWaitSlice = 1000;
+
+    /**
+     * Deferred response to an API request. The request is either taken over
+     * with httpd_req_async_handler_begin() and completed by the task that
+     * responds, or by the asset task when it times out, or the server task
+     * waits for the response to be filled in.
+     */
+    struct ApiPending {
+      TaskHandle_t waiter = nullptr;
+      httpd_req_t *req = nullptr;
+      std::string name;
+      unsigned long deadline = 0;
+      std::unique_ptr<DynamicJsonDocument> data;
+      bool error = false, done = false;
+    };
+
+    // serializes JSON straight into chunks of the HTTP response
+    class ChunkWriter {
+     public:
+      ChunkWriter(httpd_req_t *req) : _req(req) {}
+      size_t write(uint8_t c) {
+        return write(&c, 1);
+      }
+      size_t write(const uint8_t *s, size_t n) {
+        for (size_t i = 0; i < n && _result == ESP_OK;) {
+          auto len = std::min(n - i, sizeof(_buf) - _len);
+          memcpy(_buf + _len, s + i, len);
+          _len += len;
+          i += len;
+          if (_len == sizeof(_buf))
+            flush();
+        }
+        return n;
+      }
+      size_t write(const char *s) {
+        return write((const uint8_t *)s, strlen(s));
+      }
+      esp_err_t end() {
+        flush();
+        if (_result == ESP_OK)
+          _result = httpd_resp_send_chunk(_req, nullptr, 0);
+        return _result;
+      }
+
+     private:
+      httpd_req_t *_req;
+      char _buf[256];
+      size_t _len = 0;
+      esp_err_t _result = ESP_OK;
+      void flush() {
+        if (_len && _result == ESP_OK)
+          _result = httpd_resp_send_chunk(_req, _buf, _len);
+        _len = 0;
+      }
+    };
+
+    // computes the ETag of the serialized JSON without keeping it
+    class CrcWriter {
+     public:
+      uint32_t crc = 0;
+      size_t write(uint8_t c) {
+        return write(&c, 1);
+      }
+      size_t write(const uint8_t *s, size_t n) {
+        crc = deflate::crc32(crc, s, n);
+        return n;
+      }
+    };
+
+    bool etagMatches(std::string_view header, const char *etag) {
+      while (!header.empty()) {
+        auto comma = header.find(',');
+        auto item = trim(header.substr(0, comma));
+        header = comma == std::string_view::npos ? std::string_view()
+                                                 : header.substr(comma + 1);
+        // weak comparison, RFC 9110 section 13.1.2
+        if (item.substr(0, 2) == "W/")
+          item.remove_prefix(2);
+        if (item == "*" || item == etag)
+          return true;
+      }
+      return false;
+    }
+
+    esp_err_t sendApiResponse(httpd_req_t *req, const char *name,
+                              JsonVariantConst data, bool error) {
+      httpd_resp_set_type(req, "application/json");
+      httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+      if (error) {
+        // no object took the request
+        httpd_resp_set_status(req,
+                              data[0] == "unhandled" ? HTTPD_404 : HTTPD_500);
+        ChunkWriter w(req);
+        w.write("{\"error\":");
+        serializeJson(data, w);
+        w.write("}");
+        return w.end();
+      }
+      char etag[12];
+      if (!strcmp(name, AppObject::KeyStateGet)) {
+        // lets pollers skip unchanged states, at the cost of serializing
+        // the state twice
+        CrcWriter crc;
+        serializeJson(data, crc);
+        snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned)crc.crc);
+        httpd_resp_set_hdr(req, "ETag", etag);
+        std::string match;
+        if (getHeader(req, "If-None-Match", match) == ESP_OK &&
+            etagMatches(match, etag)) {
+          httpd_resp_set_status(req, "304 Not Modified");
+          return httpd_resp_send(req, nullptr, 0);
+        }
+      }
+      ChunkWriter w(req);
+      serializeJson(data, w);
+      return w.end();
+    }
+
+    class ApiRequest : public Request {
+     public:
+      ApiRequest(httpd_req_t *req, const char *name, const char *target,
+                 const JsonVariantConst data, int seq)
+          : Request(name, seq, target, data, "http"), _req(req) {}
+      bool isDeferred() const {
+        return _deferred;
+      }
+      esp_err_t result = ESP_OK;
+
+     protected:
+      void respondImpl(const char *source, const JsonVariantConst data,
+                       bool error) override {
+        if (_sent)
+          return;
+        _sent = true;
+        result = sendApiResponse(_req, name(), data, error);
+      }
+      Response *makeResponseImpl() override {
+        _deferred = true;
+        return new Response(ApiTransport, name(), target(), seq());
+      }
+
+     private:
+      httpd_req_t *_req;
+      bool _sent = false, _deferred = false;
+    };
+
     Httpd::Httpd() {
       _config = HTTPD_DEFAULT_CONFIG();
       _config.global_user_ctx = this;
       _config.global_user_ctx_free_fn = freeNop;
       _config.uri_match_fn = uriMatcher;
+      _config.open_fn = openFn;
       _config.close_fn = closeFn;
       _config.lru_purge_enable = true;
       _config.max_uri_handlers = 20;
+      // API requests are handled on the server task on IDF releases without
+      // async requests
+      _config.stack_size = 6144;
       // esp_log_level_set("httpd_ws", ESP_LOG_DEBUG);
       _httpdServers.push_back(this);
 
       net::mdns::Service *mdns = new net::mdns::Service("_http", "_tcp", 80);
       mdns->set("esp32m", ESP32M_VERSION);
       mdns->set("wsapi", "/ws");
+      mdns->set("api", "/api");
       net::Mdns::instance().set(mdns);
     }
 
@@ -191,6 +836,36 @@ namespace esp32m {
 
     void Httpd::init(Ui *ui) {
       Transport::init(ui);
+      EventManager::instance().subscribe([this](Event &ev) {
+        Response *r = nullptr;
+        // partial responses are not streamed, the final one is sent
+        if (!Response::is(ev, ApiTransport, &r) || r->isPartial())
+          return;
+        std::unique_ptr<ApiPending> finished;
+        {
+          std::lock_guard<std::mutex> guard(_apiMutex);
+          auto it = _api.find(r->seq());
+          if (it == _api.end() || it->second->done)
+            return;
+          auto &pending = *it->second;
+          if (!pending.req) {
+            if (r->data())
+              pending.data.reset(new DynamicJsonDocument(*r->data()));
+            pending.error = r->isError();
+            pending.done = true;
+            xTaskNotifyGive(pending.waiter);
+            return;
+          }
+          finished = std::move(it->second);
+          _api.erase(it);
+        }
+        // sent from the responding task, nobody waits for it
+        auto data = r->data() ? r->data()->as<JsonVariantConst>()
+                              : json::null<JsonVariantConst>();
+        finishApi(finished->req,
+                  sendApiResponse(finished->req, finished->name.c_str(), data,
+                                  r->isError()));
+      });
       if (ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_start(&_server, &_config)) ==
           ESP_OK) {
         httpd_uri_t uh = {.uri = UriWs,
@@ -201,10 +876,22 @@ namespace esp32m {
                           .handle_ws_control_frames = false,
                           .supported_subprotocol = 0};
         ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(_server, &uh));
+        uh.uri = UriApi;
+        uh.is_websocket = false;
+        uh.handler = apiHandler;
+        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(_server, &uh));
+        uh.method = HTTP_POST;
+        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(_server, &uh));
+        uh.method = HTTP_GET;
         uh.uri = UriRoot;
         uh.is_websocket = false;
         uh.handler = httpHandler;
         ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(_server, &uh));
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+        xTaskCreate([](void *self) { ((Httpd *)self)->sendAssets(); },
+                    "m/ui-assets", 3072, this, _config.task_priority,
+                    &_assetTask);
+#endif
       }
     }
 
@@ -244,26 +931,19 @@ namespace esp32m {
           logW("got %s request while AP is not running", req->uri);
       }
 
-      Asset *def = nullptr, *found = nullptr;
-      for (Asset &a : _ui->assets()) {
-        if (!strcmp(req->uri, a._uri)) {
-          found = &a;
-          break;
-        }
-        if (!strcmp(a._uri, "/"))
-          def = &a;
-      }
-      if (!found) {
-        if (!strEndsWith(req->uri, ".ico"))
-          found = def;
-        /*logI("strEndsWith %s %s %d %d", req->uri, ".js.map",
-             strEndsWith(req->uri, ".js.map"), found == nullptr);*/
-      }
-      if (!found) {
+      std::string_view uri(req->uri);
+      uri = uri.substr(0, uri.find('?'));
+      auto variants = _ui->findAsset(uri);
+      if (!variants && !strEndsWith(req->uri, ".ico"))
+        variants = _ui->findAsset(UriRoot);
+      if (!variants) {
         logI("404: %s", req->uri);
         ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send_404(req));
         return ESP_FAIL;
       }
+      std::string accept;
+      getHeader(req, "Accept-Encoding", accept);
+      auto found = selectEncoding(*variants, accept);
       char buf[40];
       // logI("serving %s", req->uri);
       if (found->_etag &&
@@ -272,25 +952,311 @@ namespace esp32m {
           !strcmp(buf, found->_etag)) {
         ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_set_status(req, "304"));
         ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send(req, nullptr, 0));
-      } else {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(
-            httpd_resp_set_type(req, found->_contentType));
-        if (found->_contentEncoding)
-          ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_set_hdr(
-              req, "Content-Encoding", found->_contentEncoding));
-        if (found->_etag) {
-          ESP_ERROR_CHECK_WITHOUT_ABORT(
-              httpd_resp_set_hdr(req, "ETag", found->_etag));
-          ESP_ERROR_CHECK_WITHOUT_ABORT(
-              httpd_resp_set_hdr(req, "Cache-Control", "no-cache"));
+      } else
+        return sendAsset(req, found, variants->size() > 1);
+
+      return ESP_OK;
+    }
+
+    esp_err_t Httpd::sendAsset(httpd_req_t *req, const Asset *asset,
+                               bool varies) {
+      size_t size = asset->size(), from = 0, to = size ? size - 1 : 0;
+      auto range = Range::None;
+      std::string hv;
+      if (size && getHeader(req, "Range", hv) == ESP_OK) {
+        std::string validator;
+        // If-Range with a stale validator asks for the whole asset
+        if (getHeader(req, "If-Range", validator) != ESP_OK ||
+            (asset->_etag && validator == asset->_etag))
+          range = parseRange(hv, size, from, to);
+      }
+      std::string head;
+      head.reserve(384);
+      auto header = [&head](const char *name, const char *value) {
+        head += name;
+        head += ": ";
+        head += value;
+        head += "\r\n";
+      };
+      if (range == Range::Unsatisfiable) {
+        head = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        header("Content-Range",
+               string_printf("bytes */%u", (unsigned)size).c_str());
+        header("Content-Length", "0");
+        head += "\r\n";
+        return sendAll(req, head.data(), head.size());
+      }
+      if (range == Range::Satisfiable)
+        head = "HTTP/1.1 206 Partial Content\r\n";
+      else
+        head = "HTTP/1.1 200 OK\r\n";
+      header("Content-Type", asset->_contentType);
+      if (asset->_contentEncoding)
+        header("Content-Encoding", asset->_contentEncoding);
+      if (varies)
+        header("Vary", "Accept-Encoding");
+      if (asset->_etag) {
+        header("ETag", asset->_etag);
+        header("Cache-Control", "no-cache");
+      }
+      header("Last-Modified", lastModified());
+      header("Accept-Ranges", "bytes");
+      if (range == Range::Satisfiable)
+        header("Content-Range",
+               string_printf("bytes %u-%u/%u", (unsigned)from, (unsigned)to,
+                             (unsigned)size)
+                   .c_str());
+      size_t len = size ? to - from + 1 : 0;
+      header("Content-Length", std::to_string(len).c_str());
+      head += "\r\n";
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+      // the server task serves all sockets, so large bodies are left to the
+      // asset task, and a slow client holds up only its own transfer
+      httpd_req_t *async;
+      if (len > AssetSlice && _assetTask &&
+          httpd_req_async_handler_begin(req, &async) == ESP_OK) {
+        {
+          std::lock_guard<std::mutex> guard(_transfersMutex);
+          _transfers.emplace_back(new AssetTransfer{
+              async, std::move(head), asset->_start + from, len, 0, millis()});
         }
-        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send(
-            req, (const char *)found->_start, found->_end - found->_start));
+        xTaskNotifyGive(_assetTask);
+        return ESP_OK;
       }
-
+#endif
+      // the client going away mid-transfer is not worth logging
+      if (sendAll(req, head.data(), head.size()) != ESP_OK ||
+          sendAll(req, (const char *)asset->_start + from, len) != ESP_OK)
+        return ESP_FAIL;
       return ESP_OK;
     }
 
+    void Httpd::sendAssets() {
+      std::vector<std::unique_ptr<AssetTransfer> > active;
+      for (;;) {
+        {
+          std::lock_guard<std::mutex> guard(_transfersMutex);
+          for (auto &t : _transfers) active.push_back(std::move(t));
+          _transfers.clear();
+        }
+        auto wait = expireApi();
+        if (active.empty()) {
+          ulTaskNotifyTake(pdTRUE, wait);
+          continue;
+        }
+        // a slice per transfer per round, without waiting for sockets that
+        // are full
+        bool progress = false;
+        auto now = millis();
+        // a client that stopped reading gives up its socket, as it would
+        // with the server sending
+        unsigned long stall = _config.send_wait_timeout * 1000;
+        for (auto it = active.begin(); it != active.end();) {
+          auto &t = **it;
+          auto fd = httpd_req_to_sockfd(t.req);
+          bool failed = false;
+          if (!t.head.empty()) {
+            // goes through the session's send override, and is small
+            // enough not to block
+            failed = sendAll(t.req, t.head.data(), t.head.size()) != ESP_OK;
+            t.head.clear();
+            progress = true;
+          } else {
+            int sent = send(fd, t.data + t.pos,
+                            std::min(AssetSlice, t.len - t.pos), MSG_DONTWAIT);
+            if (sent > 0) {
+              t.pos += sent;
+              t.progressAt = now;
+              progress = true;
+            } else
+              failed = (errno != EAGAIN && errno != EWOULDBLOCK) ||
+                       now - t.progressAt > stall;
+          }
+          if (failed || t.pos == t.len) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+            httpd_req_async_handler_complete(t.req);
+#endif
+            if (failed)
+              httpd_sess_trigger_close(_server, fd);
+            it = active.erase(it);
+          } else
+            ++it;
+        }
+        if (!progress)
+          ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AssetWait));
+      }
+    }
+
+    esp_err_t Httpd::incomingApi(httpd_req_t *req) {
+      // /api/<target>/<name>, GET /api/<target>/state is state-get
+      std::string_view path(req->uri + strlen(UriApi));
+      path = path.substr(0, path.find('?'));
+      auto slash = path.find('/');
+      if (!slash || slash == std::string_view::npos ||
+          slash + 1 == path.size() ||
+          path.find('/', slash + 1) != std::string_view::npos)
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, nullptr);
+      std::string target(path.substr(0, slash));
+      std::string name(path.substr(slash + 1));
+      if (req->method == HTTP_GET)
+        name += "-get";
+      std::unique_ptr<DynamicJsonDocument> body;
+      if (req->content_len) {
+        if (req->content_len > ApiMaxBody) {
+          httpd_resp_set_status(req, "413 Payload Too Large");
+          return httpd_resp_send(req, nullptr, 0);
+        }
+        std::string text(req->content_len, '\0');
+        for (size_t pos = 0; pos < text.size();) {
+          int received =
+              httpd_req_recv(req, text.data() + pos, text.size() - pos);
+          // a client that stops mid-body would hold up the server task
+          if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, nullptr);
+            return ESP_FAIL;
+          }
+          if (received <= 0)
+            return ESP_FAIL;
+          pos += received;
+        }
+        body.reset(json::parse(text.data(), text.size()));
+        if (!body)
+          return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                     "malformed JSON");
+      }
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+      // published by a UI worker, one at a time with other requests to the
+      // same target, while the server task goes on with other sockets;
+      // deferred responses are sent by the task that responds
+      httpd_req_t *async;
+      if (_assetTask &&
+          httpd_req_async_handler_begin(req, &async) == ESP_OK) {
+        std::shared_ptr<DynamicJsonDocument> data(std::move(body));
+        bool scheduled =
+            _ui->schedule(target.c_str(), [this, async, name, target, data]() {
+              startApi(async, name.c_str(),
+                       data ? data->as<JsonVariantConst>()
+                            : json::null<JsonVariantConst>(),
+                       target.c_str());
+            });
+        if (scheduled)
+          return ESP_OK;
+        httpd_resp_set_status(async, "503 Service Unavailable");
+        finishApi(async, httpd_resp_send(async, nullptr, 0));
+        return ESP_OK;
+      }
+#endif
+      return handleApi(req, name.c_str(),
+                       body ? body->as<JsonVariantConst>()
+                            : json::null<JsonVariantConst>(),
+                       target.c_str());
+    }
+
+    int Httpd::registerApi(httpd_req_t *req, const char *name) {
+      int seq = ++_apiSeq;
+      std::lock_guard<std::mutex> guard(_apiMutex);
+      auto &pending = _api[seq];
+      pending.reset(new ApiPending());
+      if (req) {
+        pending->req = req;
+        pending->name = name;
+        pending->deadline = millis() + ApiTimeout;
+      } else
+        pending->waiter = xTaskGetCurrentTaskHandle();
+      return seq;
+    }
+
+    void Httpd::finishApi(httpd_req_t *req, esp_err_t result) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+      auto fd = httpd_req_to_sockfd(req);
+      httpd_req_async_handler_complete(req);
+      if (result != ESP_OK)
+        httpd_sess_trigger_close(_server, fd);
+#endif
+    }
+
+    void Httpd::startApi(httpd_req_t *req, const char *name,
+                         JsonVariantConst body, const char *target) {
+      // registered first, the response may come from another task before
+      // publish() returns
+      int seq = registerApi(req, name);
+      ApiRequest ev(req, name, target, body, seq);
+      ev.publish();
+      if (ev.isDeferred()) {
+        // the asset task times it out
+        xTaskNotifyGive(_assetTask);
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> guard(_apiMutex);
+        _api.erase(seq);
+      }
+      finishApi(req, ev.result);
+    }
+
+    TickType_t Httpd::expireApi() {
+      std::vector<std::unique_ptr<ApiPending> > expired;
+      TickType_t wait = portMAX_DELAY;
+      {
+        std::lock_guard<std::mutex> guard(_apiMutex);
+        auto now = millis();
+        for (auto it = _api.begin(); it != _api.end();) {
+          auto &pending = it->second;
+          if (pending->req && (long)(now - pending->deadline) >= 0) {
+            expired.push_back(std::move(pending));
+            it = _api.erase(it);
+            continue;
+          }
+          if (pending->req)
+            wait = std::min(wait, pdMS_TO_TICKS(pending->deadline - now));
+          ++it;
+        }
+      }
+      for (auto &pending : expired) {
+        httpd_resp_set_status(pending->req, "504 Gateway Timeout");
+        finishApi(pending->req, httpd_resp_send(pending->req, nullptr, 0));
+      }
+      return wait;
+    }
+
+    esp_err_t Httpd::handleApi(httpd_req_t *req, const char *name,
+                               JsonVariantConst body, const char *target) {
+      int seq = registerApi(nullptr, name);
+      ApiRequest ev(req, name, target, body, seq);
+      ev.publish();
+      std::unique_ptr<ApiPending> pending;
+      auto started = xTaskGetTickCount();
+      for (;;) {
+        auto elapsed = xTaskGetTickCount() - started;
+        {
+          std::lock_guard<std::mutex> guard(_apiMutex);
+          auto it = _api.find(seq);
+          if (!ev.isDeferred() || it->second->done ||
+              elapsed >= pdMS_TO_TICKS(ApiTimeout)) {
+            pending = std::move(it->second);
+            _api.erase(it);
+            break;
+          }
+        }
+        // the server task is held up meanwhile, as with a slow handler; it
+        // may be watched, so wait in slices
+        if (esp_task_wdt_status(nullptr) == ESP_OK)
+          esp_task_wdt_reset();
+        ulTaskNotifyTake(pdTRUE,
+                         std::min(pdMS_TO_TICKS(ApiTimeout) - elapsed,
+                                  pdMS_TO_TICKS(ApiWaitSlice)));
+      }
+      if (!ev.isDeferred())
+        return ev.result;
+      if (!pending->done) {
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+        return httpd_resp_send(req, nullptr, 0);
+      }
+      auto data = pending->data ? pending->data->as<JsonVariantConst>()
+                                : json::null<JsonVariantConst>();
+      return sendApiResponse(req, name, data, pending->error);
+    }
+
     esp_err_t Httpd::incomingWs(httpd_req_t *req) {
       if (req->method == HTTP_GET) {
         return ESP_OK;
@@ -299,7 +1265,16 @@ namespace esp32m {
       memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
       ESP_CHECK_RETURN(httpd_ws_recv_frame(req, &ws_pkt, 0));
 
-      ws_pkt.payload = (uint8_t *)calloc(1, ws_pkt.len + 1);
+      auto fd = httpd_req_to_sockfd(req);
+      bool compressed = false;
+      {
+        std::lock_guard<std::mutex> guard(_wsMutex);
+        auto it = _ws.find(fd);
+        if (it != _ws.end())
+          compressed = it->second->deflate && it->second->compressed;
+      }
+      // room for the tail removed by the sender, RFC 7692 section 7.2.2
+      ws_pkt.payload = (uint8_t *)calloc(1, ws_pkt.len + 4);
       if (!ws_pkt.payload)
         return ESP_ERR_NO_MEM;
       esp_err_t ret = ESP_ERROR_CHECK_WITHOUT_ABORT(
@@ -307,7 +1282,16 @@ namespace esp32m {
       if (ret == ESP_OK)
         switch (ws_pkt.type) {
           case HTTPD_WS_TYPE_TEXT:
-            incoming(httpd_req_to_sockfd(req), ws_pkt.payload, ws_pkt.len);
+            if (compressed) {
+              memcpy(ws_pkt.payload + ws_pkt.len, "\x00\x00\xff\xff", 4);
+              std::string text;
+              if (deflate::inflate(ws_pkt.payload, ws_pkt.len + 4, text,
+                                   WsInflateMax))
+                incoming(fd, text.data(), text.size());
+              else
+                logW("malformed compressed message from %d", fd);
+            } else
+              incoming(fd, ws_pkt.payload, ws_pkt.len);
             break;
           default:
             logI("WS packet type %d was not handled", ws_pkt.type);
@@ -317,13 +1301,114 @@ namespace esp32m {
       return ret;
     }
 
+    // appends an unmasked text frame with the message, compressed if
+    // windowBits is not 0 and that makes it shorter
+    void wsFrame(std::string &out, const char *text, size_t len,
+                 int windowBits) {
+      std::string compressed;
+      // FIN and the text opcode
+      uint8_t header[10] = {0x80 | HTTPD_WS_TYPE_TEXT};
+      if (windowBits) {
+        deflate::compress(text, len, compressed, false, windowBits);
+        // drop the sync flush tail, RFC 7692 section 7.2.1
+        compressed.resize(compressed.size() - 4);
+        if (compressed.size() < len) {
+          header[0] |= 0x40;  // RSV1
+          text = compressed.data();
+          len = compressed.size();
+        }
+      }
+      size_t headerLen = 2;
+      if (len < 126)
+        header[1] = len;
+      else if (len < 65536) {
+        header[1] = 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        headerLen = 4;
+      } else {
+        header[1] = 127;
+        for (int i = 0; i < 8; i++)
+          header[2 + i] = (uint64_t)len >> (56 - 8 * i);
+        headerLen = 10;
+      }
+      out.reserve(out.size() + headerLen + len);
+      out.append((const char *)header, headerLen);
+      out.append(text, len);
+    }
+
     esp_err_t Httpd::wsSend(uint32_t cid, const char *text) {
-      httpd_ws_frame_t ws_pkt;
-      memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-      ws_pkt.payload = (uint8_t *)text;
-      ws_pkt.len = strlen(text);
-      ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-      return httpd_ws_send_frame_async(_server, cid, &ws_pkt);
+      size_t len = strlen(text);
+      int windowBits = 0;
+      {
+        std::lock_guard<std::mutex> guard(_wsMutex);
+        auto it = _ws.find(cid);
+        if (it == _ws.end() || !it->second->upgraded)
+          return ESP_ERR_NOT_FOUND;
+        if (it->second->deflate && len >= WsCompressMin)
+          windowBits = it->second->windowBits;
+      }
+      // compressed without holding up the server task
+      auto frame = std::make_shared<std::string>();
+      wsFrame(*frame, text, len, windowBits);
+      return queueFrame(cid, frame);
+    }
+
+    esp_err_t Httpd::sendFrame(uint32_t cid, const Frame &frame) {
+      int windowBits = 0;
+      {
+        std::lock_guard<std::mutex> guard(_wsMutex);
+        auto it = _ws.find(cid);
+        if (it == _ws.end() || !it->second->upgraded)
+          return ESP_ERR_NOT_FOUND;
+        if (it->second->deflate && frame->size() >= WsCompressMin)
+          windowBits = it->second->windowBits;
+      }
+      if (!windowBits) {
+        // framing is cheap, not worth keeping a copy of the text
+        auto plain = std::make_shared<std::string>();
+        wsFrame(*plain, frame->c_str(), frame->size(), 0);
+        return queueFrame(cid, plain);
+      }
+      // compressed once per window size, clients that negotiated the same
+      // window share the result
+      return queueFrame(
+          cid, frame->encoded(windowBits, [windowBits](const std::string &text,
+                                                       std::string &out) {
+            wsFrame(out, text.data(), text.size(), windowBits);
+          }));
+    }
+
+    esp_err_t Httpd::queueFrame(uint32_t cid,
+                                std::shared_ptr<const std::string> frame) {
+      bool ok;
+      {
+        std::lock_guard<std::mutex> guard(_wsMutex);
+        auto it = _ws.find(cid);
+        if (it == _ws.end())
+          return ESP_ERR_NOT_FOUND;
+        it->second->out.push_back(std::move(frame));
+        ok = it->second->flush(cid);
+      }
+      if (ok)
+        return ESP_OK;
+      httpd_sess_trigger_close(_server, cid);
+      return ESP_FAIL;
+    }
+
+    bool Httpd::wsFlush(uint32_t cid) {
+      bool ok, done;
+      {
+        std::lock_guard<std::mutex> guard(_wsMutex);
+        auto it = _ws.find(cid);
+        if (it == _ws.end())
+          return true;
+        ok = it->second->flush(cid);
+        done = it->second->out.empty();
+      }
+      if (!ok)
+        httpd_sess_trigger_close(_server, cid);
+      return done;
     }
 
   }  // namespace ui
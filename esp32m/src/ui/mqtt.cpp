@@ -28,38 +28,14 @@ namespace esp32m {
         _requestTopic = nullptr;
       if (asprintf(&_responseTopic, "esp32m/response/%s/", name) < 0)
         _responseTopic = nullptr;
-      net::Mqtt::instance().subscribe(_requestTopic);
+      net::Mqtt::instance().subscribe(
+          _requestTopic, [this](std::string_view topic,
+                                std::string_view payload) {
+            request(topic, payload);
+          });
       EventManager::instance().subscribe([this](Event &ev) {
         Response *r = nullptr;
-        if (net::mqtt::Incoming::is(ev)) {
-          net::mqtt::Incoming &iev = (net::mqtt::Incoming &)ev;
-          auto ctl = strlen(_requestTopic);
-          auto topic = iev.topic();
-          auto topiclen = topic.length();
-          if ((topiclen >= ctl) &&
-              !strncmp(topic.c_str(), _requestTopic, ctl - 1)) {
-            auto devlen = topiclen - ctl + 1 /* / */ + 1 /* # */;
-            auto cmdStart = topic.c_str() + ctl - 1 /* # */;
-            auto firstSlash = (char *)memchr(cmdStart, '/', devlen - 1);
-            if (firstSlash) {
-              char *devname = strndup(cmdStart, firstSlash - cmdStart);
-              char *command = strndup(firstSlash + 1,
-                                      devlen - 1 - (firstSlash - cmdStart + 1));
-              DynamicJsonDocument *doc = nullptr;
-              auto data = iev.payload();
-              if (data.size())
-                doc = json::parse(data.c_str());
-              MqttRequest req(command, 0, devname,
-                              doc ? doc->as<JsonVariantConst>()
-                                  : json::null<JsonVariantConst>());
-              req.publish();
-              free(devname);
-              free(command);
-              if (doc)
-                free(doc);
-            }
-          }
-        } else if (Response::is(ev, this->name(), &r)) {
+        if (Response::is(ev, this->name(), &r)) {
           DynamicJsonDocument *doc = r->data();
           JsonVariantConst data = doc ? doc->as<JsonVariantConst>()
                                       : json::null<JsonVariantConst>();
@@ -68,6 +44,29 @@ namespace esp32m {
       });
     }
 
+    void Mqtt::request(std::string_view topic, std::string_view payload) {
+      // the subscription guarantees the prefix, what follows is
+      // <device>/<command>
+      auto prefix = strlen(_requestTopic) - 1;
+      if (topic.size() <= prefix)
+        return;
+      auto path = topic.substr(prefix);
+      auto slash = path.find('/');
+      if (slash == std::string_view::npos)
+        return;
+      std::string devname(path.substr(0, slash));
+      std::string command(path.substr(slash + 1));
+      DynamicJsonDocument *doc = nullptr;
+      if (payload.size())
+        doc = json::parse(payload.data(), payload.size());
+      MqttRequest req(command.c_str(), 0, devname.c_str(),
+                      doc ? doc->as<JsonVariantConst>()
+                          : json::null<JsonVariantConst>());
+      req.publish();
+      if (doc)
+        delete doc;
+    }
+
     void Mqtt::respond(const char *source, int seq, const JsonVariantConst data,
                        bool isError) {
       size_t tl = strlen(_responseTopic) + strlen(source) + 1;
@@ -88,7 +87,8 @@ namespace esp32m {
       if (isError && tl)
         strlcpy(tp, "/error", tl);
       char *ds = json::allocSerialize(data);
-      net::Mqtt::instance().publish(topic, ds);
+      net::Mqtt::instance().publish(topic, ds, 0, false,
+                                    net::mqtt::Lane::Response);
       free(topic);
       if (ds)
         free(ds);
@@ -21,5 +21,9 @@ namespace esp32m {
       _ui->sessionClosed(cid);
     }
 
+    void Transport::outputPending() {
+      _ui->notifyTx();
+    }
+
   }  // namespace ui
 }  // namespace esp32m
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <esp_task_wdt.h>
 
+#include <algorithm>
+
 #include "esp32m/app.hpp"
 #include "esp32m/events/broadcast.hpp"
 #include "esp32m/events/request.hpp"
@@ -28,6 +30,40 @@ namespace esp32m {
       return json::allocSerialize(msg);
     }
 
+    const char *KeySubscribeState = "subscribe-state";
+    const char *KeyUnsubscribeState = "unsubscribe-state";
+    // EventStateChanged is not pushed more often than this, in milliseconds
+    const unsigned int MinPushInterval = 100;
+    // how often clients that can't take more data are retried, in
+    // milliseconds
+    const unsigned int TxBlockedWait = 20;
+    // limit of jobs queued by schedule()
+    const size_t MaxJobs = 16;
+
+    /**
+     * Collects the state of an object, with all strings copied, as it is
+     * kept after the object has moved on
+     */
+    class StateReq : public Request {
+     public:
+      StateReq(const char *target)
+          : Request(AppObject::KeyStateGet, 0, target,
+                    json::null<JsonVariantConst>(), nullptr) {}
+      std::shared_ptr<const DynamicJsonDocument> state;
+
+     protected:
+      void respondImpl(const char *source, const JsonVariantConst data,
+                       bool error) override {
+        if (error || state)
+          return;
+        auto text = json::allocSerialize(data);
+        if (text) {
+          state.reset(json::parse(text));
+          free(text);
+        }
+      }
+    };
+
     class Rb : public Response {
      public:
       uint32_t clientId;
@@ -48,7 +84,12 @@ namespace esp32m {
           /*if (!strcmp(name, "config-get"))
             json::dump(ui, msg, "process request");*/
           Req ev(ui, name, msg["seq"], msg["target"], msg["data"], cid);
-          ev.publish();
+          if (!strcmp(name, KeySubscribeState) ||
+              !strcmp(name, KeyUnsubscribeState))
+            ev.respond(ui->subscribeState(cid, name, msg["target"],
+                                          msg["data"]));
+          else
+            ev.publish();
         }
       }
 
@@ -80,6 +121,95 @@ namespace esp32m {
       _name = string_printf("%s-%u", ui->transport()->name(), id);
     }
 
+    bool Client::enqueue(DynamicJsonDocument *req) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      // http client may open new session with the id of the previous
+      // session that was closed just before. So the new Client will not be
+      // created, but the old one will be re-used. But, this client already
+      // received disconnected() call and will be removed by the Ui thread.
+      // This is a hack to prevent removal, assuming that if we got a
+      // message for this client, it is not disconnected
+      _disconnected = false;
+      auto arr = req->as<JsonArrayConst>();
+      size_t count = arr.isNull() ? 1 : arr.size();
+      if (_requests.size() + count > MaxRequests) {
+        logW("too many requests");
+        return false;
+      }
+      if (_requests.size() > 3) {
+        bool duplicate = arr.isNull() &&
+                         sameRequestInQueue(req->as<JsonObjectConst>());
+        for (JsonVariantConst v : arr)
+          duplicate =
+              duplicate || sameRequestInQueue(v.as<JsonObjectConst>());
+        if (duplicate) {
+          logW("duplicate request");
+          return false;
+        }
+      }
+      std::shared_ptr<DynamicJsonDocument> doc(req);
+      auto add = [&](JsonObjectConst msg) {
+        if (msg.isNull())
+          return;
+        const char *target = msg["target"];
+        _requests.push_back({doc, msg, target ? target : ""});
+      };
+      if (arr.isNull())
+        add(req->as<JsonObjectConst>());
+      else
+        for (JsonVariantConst v : arr) add(v.as<JsonObjectConst>());
+      return true;
+    }
+
+    bool Client::take(const std::set<std::string> &busy, Job &job) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      // earlier requests are all to busy targets, so none of them is to
+      // the target of the one taken
+      for (auto it = _requests.begin(); it != _requests.end(); ++it)
+        if (!busy.count(it->target)) {
+          job = std::move(*it);
+          _requests.erase(it);
+          return true;
+        }
+      return false;
+    }
+
+    void Client::send(Frame frame, FrameKind kind, const char *key) {
+      std::lock_guard guard(_sendMutex);
+      if (kind == FrameKind::Broadcast && key)
+        for (auto &o : _broadcasts)
+          if (o.key == key) {
+            _bytes += frame->size() - o.frame->size();
+            o.frame = frame;
+            return;
+          }
+      auto &queue = kind == FrameKind::Response ? _responses : _broadcasts;
+      queue.push_back({frame, key ? key : ""});
+      _bytes += frame->size();
+      for (;;) {
+        auto count = _responses.size() + _broadcasts.size();
+        if (count <= 1 || (count <= MaxFrames && _bytes <= MaxBytes))
+          break;
+        auto &victim = _broadcasts.empty() ? _responses : _broadcasts;
+        if (&victim == &_responses)
+          logW("client is too slow, dropping response");
+        _bytes -= victim.front().frame->size();
+        victim.pop_front();
+        _dropped++;
+      }
+    }
+
+    Frame Client::nextFrame() {
+      std::lock_guard guard(_sendMutex);
+      auto &queue = _responses.empty() ? _broadcasts : _responses;
+      if (queue.empty())
+        return nullptr;
+      auto frame = queue.front().frame;
+      queue.pop_front();
+      _bytes -= frame->size();
+      return frame;
+    }
+
   }  // namespace ui
 
   Ui::Ui(ui::Transport *transport) : _transport(transport) {}
@@ -89,7 +219,15 @@ namespace esp32m {
   void Ui::addAsset(const char *uri, const char *contentType,
                     const uint8_t *start, const uint8_t *end,
                     const char *contentEncoding, const char *etag) {
-    _assets.emplace_back(uri, contentType, start, end, contentEncoding, etag);
+    auto &asset = _assets.emplace_back(uri, contentType, start, end,
+                                       contentEncoding, etag);
+    _assetIndex[uri].push_back(&asset);
+  }
+
+  const std::vector<const ui::Asset *> *Ui::findAsset(
+      std::string_view uri) const {
+    auto it = _assetIndex.find(uri);
+    return it == _assetIndex.end() ? nullptr : &it->second;
   }
 
   /*    bool Ui::handleRequest(Request &req)
@@ -106,6 +244,29 @@ namespace esp32m {
       _transport->init(this);
       xTaskCreate([](void *self) { ((Ui *)self)->run(); }, "m/ui", 4096, this,
                   tskIDLE_PRIORITY, &_task);
+      xTaskCreate([](void *self) { ((Ui *)self)->transmit(); }, "m/ui-tx",
+                  4096, this, tskIDLE_PRIORITY, &_txTask);
+      for (auto &worker : _workers)
+        xTaskCreate([](void *self) { ((Ui *)self)->work(); }, "m/ui-w", 4096,
+                    this, tskIDLE_PRIORITY, &worker);
+      return;
+    }
+    EventStateChanged *sc;
+    if (EventStateChanged::is(ev, &sc) && sc->object()) {
+      bool subscribed = false;
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        for (auto &it : _clients) {
+          auto &subs = it.second->subscriptions();
+          auto sub = subs.find(sc->object()->name());
+          if (sub != subs.end()) {
+            sub->second.changed = true;
+            subscribed = true;
+          }
+        }
+      }
+      if (subscribed && _task)
+        xTaskNotifyGive(_task);
       return;
     }
     Broadcast *b;
@@ -119,7 +280,9 @@ namespace esp32m {
       if (data)
         msg["data"] = data;
       char *text = json::allocSerialize(msg);
-      wsSend(text);
+      // a newer broadcast of the same kind supersedes the queued one
+      auto key = string_printf("%s/%s", b->source(), b->name());
+      wsSend(text, key.c_str());
       free(text);
       return;
     }
@@ -165,60 +328,275 @@ namespace esp32m {
       if (seq && type) {
         char *text = ui::makeResponse(req["name"], type, seq, ui::_errors[0],
                                       true, false);
-        wsSend(cid, text);
+        c->send(std::make_shared<const ui::Message>(text),
+                ui::FrameKind::Response);
         free(text);
+        notifyTx();
       }
       delete json;
     } else
+      notifyWorkers();
+  }
+
+  void Ui::wsSend(const char *text, const char *key) {
+    auto frame = std::make_shared<const ui::Message>(text);
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      for (auto &it : _clients)
+        it.second->send(frame, ui::FrameKind::Broadcast, key);
+    }
+    notifyTx();
+  }
+
+  esp_err_t Ui::wsSend(uint32_t cid, const char *text) {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      auto i = _clients.find(cid);
+      if (i == _clients.end())
+        return ESP_ERR_NOT_FOUND;
+      i->second->send(std::make_shared<const ui::Message>(text),
+                      ui::FrameKind::Response);
+    }
+    notifyTx();
+    return ESP_OK;
+  }
+
+  void Ui::transmit() {
+    std::vector<uint32_t> cids;
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        cids.clear();
+        for (auto &it : _clients) cids.push_back(it.first);
+      }
+      // one frame per client per round; the transport doesn't block, and
+      // a client whose socket is full is skipped until it catches up, so
+      // that it delays only its own queue
+      bool sent = false, blocked = false;
+      for (auto cid : cids) {
+        if (!_transport->wsFlush(cid)) {
+          blocked = true;
+          continue;
+        }
+        ui::Frame frame;
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          auto it = _clients.find(cid);
+          if (it != _clients.end())
+            frame = it->second->nextFrame();
+        }
+        if (!frame)
+          continue;
+        _transport->sendFrame(cid, frame);
+        sent = true;
+      }
+      if (!sent)
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(blocked ? ui::TxBlockedWait
+                                                       : 1000));
+    }
+  }
+
+  esp_err_t Ui::subscribeState(uint32_t cid, const char *name,
+                               JsonVariantConst target,
+                               JsonVariantConst data) {
+    // targets may be given as a list in data, or as the request target
+    std::vector<std::string> targets;
+    auto list = data["targets"].as<JsonArrayConst>();
+    if (list.isNull()) {
+      if (target.is<const char *>())
+        targets.push_back(target.as<const char *>());
+    } else
+      for (JsonVariantConst t : list)
+        if (t.is<const char *>())
+          targets.push_back(t.as<const char *>());
+    bool subscribe = !strcmp(name, ui::KeySubscribeState);
+    if (subscribe && targets.empty())
+      return ESP_ERR_INVALID_ARG;
+    int interval = data["interval"] | 1000;
+    interval = std::max(interval, (int)ui::MinPushInterval);
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      auto i = _clients.find(cid);
+      if (i == _clients.end())
+        return ESP_ERR_NOT_FOUND;
+      auto &subs = i->second->subscriptions();
+      if (!subscribe && targets.empty())
+        subs.clear();
+      for (auto &t : targets)
+        if (subscribe) {
+          // start over with the full state
+          auto &sub = subs[t];
+          sub.last.reset();
+          sub.interval = interval;
+          sub.changed = true;
+        } else
+          subs.erase(t);
+    }
+    if (subscribe && _task)
       xTaskNotifyGive(_task);
+    return ESP_OK;
   }
 
-  void Ui::wsSend(const char *text) {
+  int Ui::pushStates() {
+    auto now = millis();
+    unsigned int wait = 1000;
+    // due subscriptions are collected under the lock, the states are
+    // fetched without it, once per object
+    std::map<std::string, std::shared_ptr<const DynamicJsonDocument> > states;
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      for (auto &it : _clients)
+        for (auto &[name, sub] : it.second->subscriptions()) {
+          auto elapsed = now - sub.checkedAt;
+          auto next = sub.changed ? ui::MinPushInterval : sub.interval;
+          if (elapsed < next) {
+            if (next - elapsed < wait)
+              wait = next - elapsed;
+          } else if (_busy.count(name))
+            // a worker is processing a request to the object, the state
+            // is fetched after it is done, like any other request
+            wait = std::min(wait, ui::MinPushInterval);
+          else
+            states[name];
+        }
+      for (auto &[name, state] : states) _busy.insert(name);
+    }
+    if (states.empty())
+      return wait;
+    for (auto &[name, state] : states) {
+      ui::StateReq req(name.c_str());
+      req.publish();
+      state = req.state;
+    }
     std::lock_guard<std::mutex> guard(_mutex);
-    for (auto it = _clients.begin(); it != _clients.end(); ++it)
-      wsSend(it->first, text);
+    for (auto &[name, state] : states) _busy.erase(name);
+    // requests to these objects may be waiting
+    notifyWorkers();
+    for (auto &it : _clients) {
+      auto client = it.second.get();
+      for (auto &[name, sub] : client->subscriptions()) {
+        auto state = states.find(name);
+        if (state == states.end())
+          continue;
+        sub.checkedAt = now;
+        sub.changed = false;
+        if (!state->second)
+          continue;
+        auto next = state->second->as<JsonVariantConst>();
+        // the client may have missed a patch if frames were dropped
+        bool full = !sub.last || sub.dropped != client->dropped();
+        DynamicJsonDocument msg(JSON_OBJECT_SIZE(4) +
+                                state->second->memoryUsage() +
+                                (full ? 0 : sub.last->memoryUsage()));
+        msg["type"] = "state";
+        msg["source"] = name.c_str();
+        if (full) {
+          msg["full"] = true;
+          msg["data"] = next;
+        } else if (!json::diff(sub.last->as<JsonVariantConst>(), next,
+                               msg["data"].to<JsonVariant>()))
+          continue;
+        sub.last = state->second;
+        sub.dropped = client->dropped();
+        char *text = json::allocSerialize(msg);
+        if (text) {
+          client->send(std::make_shared<const ui::Message>(text),
+                       ui::FrameKind::Broadcast);
+          free(text);
+        }
+      }
+    }
+    notifyTx();
+    return wait;
   }
 
-  esp_err_t Ui::wsSend(uint32_t cid, const char *text) {
-    std::lock_guard<std::mutex> guard(_sendMutex);
-    return _transport->wsSend(cid, text);
+  bool Ui::schedule(const char *target, std::function<void()> fn) {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      if (_jobs.size() >= ui::MaxJobs)
+        return false;
+      auto &job = _jobs.emplace_back();
+      job.target = target ? target : "";
+      job.run = std::move(fn);
+    }
+    notifyWorkers();
+    return true;
+  }
+
+  bool Ui::nextJob(ui::Job &job, uint32_t &cid) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    // start with the client after the one served last, so that a client
+    // sending many requests doesn't hold up the others; the scheduled jobs
+    // take their turn after the last client
+    auto it = _clients.upper_bound(_served);
+    for (auto n = _clients.size() + 1; n; n--) {
+      if (it == _clients.end()) {
+        it = _clients.begin();
+        for (auto j = _jobs.begin(); j != _jobs.end(); ++j)
+          if (!_busy.count(j->target)) {
+            job = std::move(*j);
+            _jobs.erase(j);
+            cid = _served = 0;
+            _busy.insert(job.target);
+            return true;
+          }
+        continue;
+      }
+      auto client = it->second.get();
+      auto id = (it++)->first;
+      if (!client->isDisconnected() && client->take(_busy, job)) {
+        cid = _served = id;
+        _busy.insert(job.target);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Ui::work() {
+    esp_task_wdt_add(NULL);
+    ui::Job job;
+    uint32_t cid;
+    for (;;) {
+      esp_task_wdt_reset();
+      if (!nextJob(job, cid)) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        continue;
+      }
+      if (job.run)
+        job.run();
+      else
+        ui::Req::process(this, cid, job.msg);
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _busy.erase(job.target);
+      }
+      job.doc.reset();
+      job.run = nullptr;
+      // requests to the same target may be waiting for another worker
+      notifyWorkers();
+    }
+  }
+
+  void Ui::notifyWorkers() {
+    for (auto worker : _workers)
+      if (worker)
+        xTaskNotifyGive(worker);
   }
 
   void Ui::run() {
     esp_task_wdt_add(NULL);
     for (;;) {
       esp_task_wdt_reset();
-      DynamicJsonDocument *req = nullptr;
-      uint32_t cid = 0;
       {
         std::lock_guard<std::mutex> guard(_mutex);
-        for (auto it = _clients.begin(); it != _clients.end();) {
-          auto client = it->second.get();
-          if (client->isDisconnected()) {
+        for (auto it = _clients.begin(); it != _clients.end();)
+          if (it->second->isDisconnected())
             it = _clients.erase(it);
-          } else {
-            req = client->dequeue();
-            cid = it->first;
-            if (req)
-              break;
+          else
             ++it;
-          }
-        }
       }
-      if (req) {
-        JsonArrayConst arr = req->as<JsonArrayConst>();
-        if (!arr.isNull())
-          for (JsonVariantConst v : arr) {
-            esp_task_wdt_reset();
-            ui::Req::process(this, cid, v.as<JsonObjectConst>());
-          }
-        else
-          ui::Req::process(this, cid, req->as<JsonObjectConst>());
-        delete req;
-        continue;
-      }
-
-      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(pushStates()));
     }
   }
-}  // namespace esp32m
\ No newline at end of file
+}  // namespace esp32m
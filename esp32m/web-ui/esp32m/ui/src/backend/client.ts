@@ -13,6 +13,7 @@ import {
   TMessage,
   TRequest,
   TResponse,
+  TStatePatch,
 } from './types';
 import { Subject } from 'rxjs';
 import WebSocket from 'reconnecting-websocket';
@@ -44,6 +45,9 @@ export function isResponse(msg: TMessage): msg is TResponse {
 export function isBroadcast(msg: TMessage): msg is TBroadcast {
   return msg.type === 'broadcast' && isString((msg as TBroadcast).source);
 }
+export function isStatePatch(msg: TMessage): msg is TStatePatch {
+  return msg.type === 'state' && isString((msg as TStatePatch).source);
+}
 
 class Module implements IModuleApi {
   readonly selectors;
@@ -87,6 +91,8 @@ class Client implements IBackendApi {
   constructor(readonly ws: WebSocket) {
     ws.onopen = () => {
       this.status.set(ConnectionStatus.Connected);
+      // subscriptions do not survive reconnects
+      this._subscribed.clear();
       this._statePoller.enable();
     };
     ws.onclose = () => {
@@ -211,10 +217,45 @@ class Client implements IBackendApi {
   private _seq: number = Math.floor(Math.random() * (Math.pow(2, 31) / 2));
   private readonly _pending: { [key: number]: TPendingRequest } = {};
   private readonly _devices: Record<string, Module> = {};
+  // modules whose state changes are pushed by the server
+  private readonly _subscribed = new Set<string>();
+  // older firmware does not support subscriptions
+  private _canSubscribe = true;
+  private async updateSubscriptions(names: string[]) {
+    const added = names.filter((n) => !this._subscribed.has(n));
+    const removed = [...this._subscribed].filter((n) => !names.includes(n));
+    added.forEach((n) => this._subscribed.add(n));
+    removed.forEach((n) => this._subscribed.delete(n));
+    const tasks: Promise<unknown>[] = [];
+    if (added.length)
+      tasks.push(
+        this.request('ui', 'subscribe-state', { targets: added }).catch(
+          (e) => {
+            // only firmware without subscriptions doesn't know the request,
+            // other failures are retried on the next poll
+            if (e?.code === 'unhandled') this._canSubscribe = false;
+            added.forEach((n) => this._subscribed.delete(n));
+            throw e;
+          }
+        )
+      );
+    if (removed.length)
+      tasks.push(
+        this.request('ui', 'unsubscribe-state', { targets: removed })
+      );
+    await Promise.allSettled(tasks);
+  }
   private readonly _statePoller = new Periodic(async () => {
-    const tasks = Object.values(this._devices)
-      .filter((d) => d.isPolling())
+    const polling = Object.values(this._devices).filter((d) => d.isPolling());
+    // state requested with arguments can't be pushed
+    const subscribe = this._canSubscribe
+      ? polling.filter((d) => d.stateGetData === undefined)
+      : [];
+    const tasks: Promise<unknown>[] = polling
+      .filter((d) => !subscribe.includes(d))
       .map((d) => this.getState(d.name, d.stateGetData));
+    if (this._canSubscribe)
+      tasks.push(this.updateSubscriptions(subscribe.map((d) => d.name)));
     await Promise.allSettled(tasks);
   }, 1000);
 }
@@ -5,7 +5,7 @@ import { actions as publicActions } from './types';
 import { TAppLoadingPlugin, TUiRootPlugin } from '@ts-libs/ui-base';
 import { Hoc } from './hoc';
 import { ConnectionStatus } from './types';
-import { client, isBroadcast, isResponse } from './client';
+import { client, isBroadcast, isResponse, isStatePatch } from './client';
 import { TErrorDeserializerPlugin } from '@ts-libs/tools';
 import { EspError } from './errors';
 import { Ti18nPlugin } from '@ts-libs/ui-i18n';
@@ -23,6 +23,8 @@ export const pluginUiBackend = (): TReduxPlugin &
     });
     c.incoming.subscribe((msg) => {
       if (isBroadcast(msg)) api.dispatch(publicActions.broadcast(msg));
+      else if (isStatePatch(msg))
+        api.dispatch(actions.devicePatch([msg.source, msg.data, msg.full]));
       else if (isResponse(msg) && !msg.error)
         if (msg.name == 'state-get')
           api.dispatch(actions.deviceState([msg.source, msg.data]));
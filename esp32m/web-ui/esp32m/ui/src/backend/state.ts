@@ -29,6 +29,19 @@ const initialState: TBackendState = {
   modules: {},
 };
 
+const isObject = (v: unknown): v is Record<string, unknown> =>
+  typeof v === 'object' && v !== null && !Array.isArray(v);
+
+// RFC 7386 JSON merge patch
+const mergePatch = (target: unknown, patch: unknown): unknown => {
+  if (!isObject(patch)) return patch;
+  const result = isObject(target) ? target : {};
+  for (const [k, v] of Object.entries(patch))
+    if (v === null) delete result[k];
+    else result[k] = mergePatch(result[k], v);
+  return result;
+};
+
 const slice = createSlice({
   name: Name,
   initialState,
@@ -47,6 +60,15 @@ const slice = createSlice({
       const ds = state.modules[name] || (state.modules[name] = { state: {} });
       ds.state = moduleState;
     },
+    devicePatch: (
+      state,
+      {
+        payload: [name, patch, full],
+      }: PayloadAction<[string, unknown, boolean | undefined]>
+    ) => {
+      const ds = state.modules[name] || (state.modules[name] = { state: {} });
+      ds.state = full ? patch : mergePatch(ds.state, patch);
+    },
   },
 });
 
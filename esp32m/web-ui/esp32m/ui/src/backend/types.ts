@@ -35,6 +35,12 @@ export type TBroadcast = TMessage & {
   source: string;
 };
 
+export type TStatePatch = TMessage & {
+  type: 'state';
+  source: string;
+  full?: boolean;
+};
+
 export interface IModuleApi {
   readonly api: IBackendApi;
   readonly name: string;
@@ -0,0 +1,28 @@
+#include <esp32m/app.hpp>
+#include <esp32m/net/ethernet.hpp>
+#include <esp32m/net/interfaces.hpp>
+#include <esp32m/net/mqtt.hpp>
+
+#include <esp32m/dev/esp32.hpp>
+#include <esp32m/integrations/influx/mqtt.hpp>
+#include <esp32m/log/mqtt.hpp>
+
+#include <esp32m/ui.hpp>
+#include <esp32m/ui/mqtt.hpp>
+
+using namespace esp32m;
+
+extern "C" void app_main()
+{
+  App::Init app;
+  dev::useEsp32();
+  net::useOpenethEthernet();
+  net::useInterfaces();
+  // the broker is mqtt-bench.py on the host, see sdkconfig.defaults
+  net::useMqtt();
+  net::mqtt::StatePublisher::instance();
+  integrations::influx::useMqtt();
+  log::addAppender(&log::Mqtt::instance());
+  // requests arrive over MQTT instead of websocket
+  new Ui(&ui::Mqtt::instance());
+}